@@ -0,0 +1,70 @@
+/*
+ * WebSocketClientReconnectHeap.ino
+ *
+ * connects and disconnects 10000 times and prints the heap state,
+ * used to measure the heap fragmentation caused by the handshake
+ *
+ */
+
+#include <Arduino.h>
+
+#include <ESP8266WiFi.h>
+#include <ESP8266WiFiMulti.h>
+
+#include <WebSocketsClient.h>
+
+#define RECONNECTS 10000
+#define REPORT_EVERY 1000
+
+ESP8266WiFiMulti WiFiMulti;
+WebSocketsClient webSocket;
+bool reconnect = false;
+
+#define USE_SERIAL Serial
+
+void report(uint32_t connects) {
+	USE_SERIAL.printf("[HEAP] connects: %u free: %u max block: %u fragmentation: %u%%\n",
+		connects, ESP.getFreeHeap(), ESP.getMaxFreeBlockSize(), ESP.getHeapFragmentation());
+}
+
+void webSocketEvent(WStype_t type, uint8_t * payload, size_t length) {
+	if(type != WStype_CONNECTED) {
+		return;
+	}
+
+	uint32_t connects = webSocket.getStats().connects;
+	if(connects % REPORT_EVERY == 0) {
+		report(connects);
+	}
+
+	reconnect = (connects < RECONNECTS);
+}
+
+void setup() {
+	USE_SERIAL.begin(115200);
+
+	USE_SERIAL.println();
+
+	WiFiMulti.addAP("SSID", "passpasspass");
+
+	while(WiFiMulti.run() != WL_CONNECTED) {
+		delay(100);
+	}
+
+	report(0);
+
+	// server address, port and URL
+	webSocket.begin("192.168.0.123", 81, "/");
+	webSocket.onEvent(webSocketEvent);
+	webSocket.setReconnectInterval(0);
+}
+
+void loop() {
+	webSocket.loop();
+
+	if(reconnect) {
+		// the next loop() connects again
+		reconnect = false;
+		webSocket.disconnect();
+	}
+}
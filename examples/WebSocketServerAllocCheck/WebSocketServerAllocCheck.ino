@@ -0,0 +1,90 @@
+/*
+ * WebSocketServerAllocCheck.ino
+ *
+ * checks that receiving and sending frames does not allocate memory
+ * once a connection is warmed up.
+ * all memory of the library goes through the counting allocator hooks,
+ * every loop() call handling a message after the warm up has to do 0 allocations.
+ *
+ * connect a client to port 81 and send text messages (up to WEBSOCKETS_RX_BUFFER_KEEP byte),
+ * each message is echoed back.
+ *
+ */
+
+#include <Arduino.h>
+
+#include <ESP8266WiFi.h>
+#include <ESP8266WiFiMulti.h>
+
+#include <WebSocketsServer.h>
+
+#define WARMUP 10
+#define REPORT_EVERY 1000
+
+ESP8266WiFiMulti WiFiMulti;
+WebSocketsServer webSocket(81);
+
+#define USE_SERIAL Serial
+
+uint32_t allocs     = 0;
+uint32_t messages   = 0;
+uint32_t checked    = 0;
+uint32_t allocating = 0;
+
+void * countingMalloc(size_t size) {
+	allocs++;
+	return malloc(size);
+}
+
+void countingFree(void * ptr) {
+	free(ptr);
+}
+
+void webSocketEvent(uint8_t num, WStype_t type, uint8_t * payload, size_t length) {
+	if(type != WStype_TEXT) {
+		return;
+	}
+	messages++;
+	webSocket.sendTXT(num, payload, length);
+}
+
+void setup() {
+	USE_SERIAL.begin(115200);
+
+	USE_SERIAL.println();
+
+	// before the server allocates anything
+	WebSockets::setAllocator(countingMalloc, countingFree);
+
+	WiFiMulti.addAP("SSID", "passpasspass");
+
+	while(WiFiMulti.run() != WL_CONNECTED) {
+		delay(100);
+	}
+
+	webSocket.begin();
+	webSocket.onEvent(webSocketEvent);
+
+	USE_SERIAL.printf("[SETUP] ws://%s:81/\n", WiFi.localIP().toString().c_str());
+}
+
+void loop() {
+	uint32_t allocsBefore   = allocs;
+	uint32_t messagesBefore = messages;
+
+	webSocket.loop();
+
+	if(messages == messagesBefore || messagesBefore < WARMUP) {
+		return;
+	}
+
+	checked++;
+	if(allocs != allocsBefore) {
+		allocating++;
+		USE_SERIAL.printf("[CHECK] message %u: %u allocations\n", messages, allocs - allocsBefore);
+	}
+
+	if(checked % REPORT_EVERY == 0) {
+		USE_SERIAL.printf("[CHECK] checked: %u allocating: %u -> %s\n", checked, allocating, allocating ? "FAIL" : "OK");
+	}
+}
@@ -67,7 +67,7 @@ void SocketIOclient::configureEIOping(bool disableHeartbeat) {
 }
 
 void SocketIOclient::initClient(void) {
-    if(_client.cUrl.indexOf("EIO=4") != -1) {
+    if(_url.indexOf("EIO=4") != -1) {
         DEBUG_WEBSOCKETS("[wsIOc] found EIO=4 disable EIO ping on client\n");
         configureEIOping(true);
     }
@@ -113,15 +113,16 @@ bool SocketIOclient::send(socketIOmessageType_t type, uint8_t * payload, size_t
     }
     if(clientIsConnected(&_client) && _client.status == WSC_CONNECTED) {
         if(!headerToPayload) {
+            uint8_t maskKey[4];
             // webSocket Header
-            ret = WebSocketsClient::sendFrameHeader(&_client, WSop_text, length + 2, true);
+            ret = WebSocketsClient::sendFrameHeader(&_client, WSop_text, length + 2, true, maskKey);
             // Engine.IO / Socket.IO Header
             if(ret) {
                 uint8_t buf[3] = { eIOtype_MESSAGE, type, 0x00 };
-                ret            = WebSocketsClient::write(&_client, buf, 2);
+                ret            = (WebSocketsClient::writeMasked(&_client, buf, 2, maskKey) == 2);
             }
             if(ret && payload && length > 0) {
-                ret = WebSocketsClient::write(&_client, payload, length);
+                ret = (WebSocketsClient::writeMasked(&_client, payload, length, maskKey, 2) == length);
             }
             return ret;
         } else {
@@ -175,6 +176,28 @@ bool SocketIOclient::sendEVENT(String & payload) {
     return sendEVENT((uint8_t *)payload.c_str(), payload.length());
 }
 
+/**
+ * writer to build a event in place (no copy, see WebSocketsFrameWriter)
+ * the Engine.IO / Socket.IO header is already written
+ * @return WebSocketsFrameWriter, send it with send()
+ */
+WebSocketsFrameWriter SocketIOclient::frameEVENT(void) {
+    return frame(sIOtype_EVENT);
+}
+
+/**
+ * writer to build a message in place (no copy, see WebSocketsFrameWriter)
+ * @param type socketIOmessageType_t
+ * @return WebSocketsFrameWriter, send it with send()
+ */
+WebSocketsFrameWriter SocketIOclient::frame(socketIOmessageType_t type) {
+    WebSocketsFrameWriter writer = WebSocketsClient::frameTXT();
+    // Engine.IO / Socket.IO Header
+    writer.write((uint8_t)eIOtype_MESSAGE);
+    writer.write((uint8_t)type);
+    return writer;
+}
+
 void SocketIOclient::loop(void) {
     WebSocketsClient::loop();
     unsigned long t = millis();
@@ -185,6 +208,24 @@ void SocketIOclient::loop(void) {
     }
 }
 
+#if(WEBSOCKETS_NETWORK_TYPE != NETWORK_ESP8266_ASYNC)
+/**
+ * time until loop() has work to do (see WebSocketsClient::nextTimeout)
+ * @return ms
+ */
+uint32_t SocketIOclient::nextTimeout(void) {
+    uint32_t timeout = WebSocketsClient::nextTimeout();
+    if(!_disableHeartbeat) {
+        unsigned long t = (millis() - _lastHeartbeat);
+        if(t > EIO_HEARTBEAT_INTERVAL) {
+            return 0;
+        }
+        timeout = std::min(timeout, (uint32_t)(EIO_HEARTBEAT_INTERVAL - t + 1));
+    }
+    return timeout;
+}
+#endif
+
 void SocketIOclient::handleCbEvent(WStype_t type, uint8_t * payload, size_t length) {
     switch(type) {
         case WStype_DISCONNECTED:
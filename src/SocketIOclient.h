@@ -79,10 +79,16 @@ class SocketIOclient : protected WebSocketsClient {
     bool send(socketIOmessageType_t type, const char * payload, size_t length = 0);
     bool send(socketIOmessageType_t type, String & payload);
 
+    WebSocketsFrameWriter frameEVENT(void);
+    WebSocketsFrameWriter frame(socketIOmessageType_t type);
+
     void setExtraHeaders(const char * extraHeaders = NULL);
     void setReconnectInterval(unsigned long time);
 
     void loop(void);
+#if(WEBSOCKETS_NETWORK_TYPE != NETWORK_ESP8266_ASYNC)
+    uint32_t nextTimeout(void);
+#endif
 
     void configureEIOping(bool disableHeartbeat = false);
 
@@ -59,6 +59,125 @@ extern "C" {
 
 #endif
 
+// every block from memAlloc() starts with its size (for the accounting in memFree())
+typedef union {
+    size_t size;
+    void * ptr;
+    double align;
+} WSmemHeader_t;
+
+static WSmallocFunc memMalloc = malloc;
+static WSfreeFunc memRelease  = free;
+static WSmemoryStats_t memStats;
+
+/**
+ * route all allocations of the library to a other allocator (PSRAM, pool, ...)
+ * Note: set it before the first begin(), blocks are given back to the allocator they came from
+ * @param mallocFunc WSmallocFunc   NULL = malloc
+ * @param freeFunc WSfreeFunc       NULL = free
+ */
+void WebSockets::setAllocator(WSmallocFunc mallocFunc, WSfreeFunc freeFunc) {
+    memMalloc  = mallocFunc ? mallocFunc : malloc;
+    memRelease = freeFunc ? freeFunc : free;
+}
+
+/**
+ * limit the memory all connections of the library use together
+ * new connections are refused and too big frames are closed with 1009 when the budget is exhausted
+ * @param budget size_t  byte, 0 = unlimited
+ */
+void WebSockets::setMemoryBudget(size_t budget) {
+    memStats.budget = budget;
+}
+
+/**
+ * @return WSmemoryStats_t  used memory and high-water mark
+ */
+WSmemoryStats_t WebSockets::getMemoryStats(void) {
+    return memStats;
+}
+
+/**
+ * checks if size byte can be allocated without exceeding the budget
+ * @param size size_t
+ * @return true if it fits
+ */
+bool WebSockets::memAvailable(size_t size) {
+    if(memStats.budget == 0) {
+        return true;
+    }
+    return (memStats.used + size + sizeof(WSmemHeader_t)) <= memStats.budget;
+}
+
+/**
+ * allocate memory for the library
+ * @param size size_t
+ * @return ptr or NULL (budget exhausted or no memory), give it back with memFree()
+ */
+void * WebSockets::memAlloc(size_t size) {
+    if(!memAvailable(size)) {
+        DEBUG_WEBSOCKETS("[WS][memAlloc] budget exhausted (%u + %u > %u)\n", memStats.used, size, memStats.budget);
+        memStats.refused++;
+        return NULL;
+    }
+
+    WSmemHeader_t * header = (WSmemHeader_t *)memMalloc(size + sizeof(WSmemHeader_t));
+    if(!header) {
+        memStats.failed++;
+        return NULL;
+    }
+
+    header->size = size + sizeof(WSmemHeader_t);
+    memStats.allocs++;
+    memStats.used += header->size;
+    if(memStats.used > memStats.peak) {
+        memStats.peak = memStats.used;
+    }
+    return (header + 1);
+}
+
+/**
+ * free memory from memAlloc()
+ * @param ptr void *
+ */
+void WebSockets::memFree(void * ptr) {
+    if(!ptr) {
+        return;
+    }
+    WSmemHeader_t * header = ((WSmemHeader_t *)ptr) - 1;
+    memStats.used -= header->size;
+    memRelease(header);
+}
+
+#ifdef WEBSOCKETS_USE_BIG_MEM
+// buffer to send header and payload in one TCP package, shared by all connections
+static uint8_t * packBufferPtr;
+static size_t packBufferSize;
+static bool packBufferBusy;
+
+/**
+ * get the shared pack buffer of sendFrame (grows to the biggest package, no allocation in the steady state)
+ * @param size size_t
+ * @return buffer or NULL (in use or no memory), set packBufferBusy = false when done
+ */
+uint8_t * WebSockets::packBuffer(size_t size) {
+    if(packBufferBusy) {
+        return NULL;
+    }
+    if(size > packBufferSize) {
+        memFree(packBufferPtr);
+        packBufferSize = std::min((size + 127) & ~((size_t)127), (size_t)(1400 + WEBSOCKETS_MAX_HEADER_SIZE));
+        packBufferPtr  = (uint8_t *)memAlloc(packBufferSize);
+        if(!packBufferPtr) {
+            packBufferSize = 0;
+            return NULL;
+        }
+    }
+    packBufferBusy = true;
+    return packBufferPtr;
+}
+#endif
+
 /**
  *
  * @param client WSclient_t *  ptr to the client struct
@@ -81,6 +200,28 @@ void WebSockets::clientDisconnect(WSclient_t * client, uint16_t code, char * rea
     clientDisconnect(client);
 }
 
+/**
+ * start the close handshake without dropping the tcp connection,
+ * the connection is dropped when the close of the peer is received
+ * @param client WSclient_t *  ptr to the client struct
+ * @param code uint16_t see RFC
+ * @return true if the close frame is send
+ */
+bool WebSockets::clientClose(WSclient_t * client, uint16_t code) {
+    DEBUG_WEBSOCKETS("[WS][%d][handleWebsocket] clientClose code: %u\n", client->num, code);
+    if(client->status != WSC_CONNECTED) {
+        return false;
+    }
+    uint8_t buffer[2];
+    buffer[0] = ((code >> 8) & 0xFF);
+    buffer[1] = (code & 0xFF);
+    if(!sendFrame(client, WSop_close, &buffer[0], 2)) {
+        return false;
+    }
+    client->status = WSC_CLOSING;
+    return true;
+}
+
 /**
  *
  * @param buf uint8_t *         ptr to the buffer for writing
@@ -172,12 +313,23 @@ uint8_t WebSockets::createHeader(uint8_t * headerPtr, WSopcode_t opcode, size_t
  * @param opcode WSopcode_t
  * @param length size_t         length of the payload
  * @param fin bool              can be used to send data in more then one frame (set fin on the last frame)
+ * @param maskKey uint8_t *     client only: gets the mask key of the frame, the payload has to be send with writeMasked (NULL = no masking)
  * @return true if ok
  */
-bool WebSockets::sendFrameHeader(WSclient_t * client, WSopcode_t opcode, size_t length, bool fin) {
-    uint8_t maskKey[4]                         = { 0x00, 0x00, 0x00, 0x00 };
+bool WebSockets::sendFrameHeader(WSclient_t * client, WSopcode_t opcode, size_t length, bool fin, uint8_t * maskKey) {
+    uint8_t noMask[4]                          = { 0x00, 0x00, 0x00, 0x00 };
     uint8_t buffer[WEBSOCKETS_MAX_HEADER_SIZE] = { 0 };
 
+    if(maskKey) {
+        if(client->cIsClient) {
+            newMaskKey(client, maskKey);
+        } else {
+            memset(maskKey, 0x00, 4);
+        }
+    } else {
+        maskKey = noMask;
+    }
+
     uint8_t headerSize = createHeader(&buffer[0], opcode, length, client->cIsClient, maskKey, fin);
 
     if(write(client, &buffer[0], headerSize) != headerSize) {
@@ -208,11 +360,22 @@ bool WebSockets::sendFrame(WSclient_t * client, WSopcode_t opcode, uint8_t * pay
         return false;
     }
 
+    if(client->cTxFragmenting && !(opcode & 0x08)) {
+        // only control frames can go between the frames of a message
+        DEBUG_WEBSOCKETS("[WS][%d][sendFrame] fragmented send running, data frame refused!\n", client->num);
+        return false;
+    }
+
+    if(fin && client->limits.maxSendFrameSize && length > client->limits.maxSendFrameSize && (opcode == WSop_text || opcode == WSop_binary)) {
+        return sendFragmented(client, opcode, (headerToPayload ? (payload + WEBSOCKETS_MAX_HEADER_SIZE) : payload), length);
+    }
+
     DEBUG_WEBSOCKETS("[WS][%d][sendFrame] ------- send message frame -------\n", client->num);
     DEBUG_WEBSOCKETS("[WS][%d][sendFrame] fin: %u opCode: %u mask: %u length: %u headerToPayload: %u\n", client->num, fin, opcode, client->cIsClient, length, headerToPayload);
 
     if(opcode == WSop_text) {
-        DEBUG_WEBSOCKETS("[WS][%d][sendFrame] text: %s\n", client->num, (payload + (headerToPayload ? 14 : 0)));
+        // payloads of the application (sendTXTOwned) are not 0 terminated
+        DEBUG_WEBSOCKETS("[WS][%d][sendFrame] text: %.*s\n", client->num, (int)length, (payload + (headerToPayload ? 14 : 0)));
     }
 
     uint8_t maskKey[4]                         = { 0x00, 0x00, 0x00, 0x00 };
@@ -222,6 +385,7 @@ bool WebSockets::sendFrame(WSclient_t * client, WSopcode_t opcode, uint8_t * pay
     uint8_t * headerPtr;
     uint8_t * payloadPtr = payload;
     bool useInternBuffer = false;
+    bool maskInPlace     = false;
     bool ret             = true;
 
     // calculate header Size
@@ -242,7 +406,7 @@ bool WebSockets::sendFrame(WSclient_t * client, WSopcode_t opcode, uint8_t * pay
     // try to send data in one TCP package (only if some free Heap is there)
     if(!headerToPayload && ((length > 0) && (length < 1400)) && (GET_FREE_HEAP > 6000)) {
         DEBUG_WEBSOCKETS("[WS][%d][sendFrame] pack to one TCP package...\n", client->num);
-        uint8_t * dataPtr = (uint8_t *)malloc(length + WEBSOCKETS_MAX_HEADER_SIZE);
+        uint8_t * dataPtr = packBuffer(length + WEBSOCKETS_MAX_HEADER_SIZE);
         if(dataPtr) {
             memcpy((dataPtr + WEBSOCKETS_MAX_HEADER_SIZE), payload, length);
             headerToPayload = true;
@@ -260,28 +424,17 @@ bool WebSockets::sendFrame(WSclient_t * client, WSopcode_t opcode, uint8_t * pay
         headerPtr = &buffer[0];
     }
 
-    if(client->cIsClient && useInternBuffer) {
-        // if we use a Intern Buffer we can modify the data
-        // by this fact its possible the do the masking
-        for(uint8_t x = 0; x < sizeof(maskKey); x++) {
-            maskKey[x] = random(0xFF);
-        }
+    if(client->cIsClient) {
+        newMaskKey(client, maskKey);
     }
 
     createHeader(headerPtr, opcode, length, client->cIsClient, maskKey, fin);
 
-    if(client->cIsClient && useInternBuffer) {
-        uint8_t * dataMaskPtr;
-
-        if(headerToPayload) {
-            dataMaskPtr = (payloadPtr + WEBSOCKETS_MAX_HEADER_SIZE);
-        } else {
-            dataMaskPtr = payloadPtr;
-        }
-
-        for(size_t x = 0; x < length; x++) {
-            dataMaskPtr[x] = (dataMaskPtr[x] ^ maskKey[x % 4]);
-        }
+    if(client->cIsClient && headerToPayload && length > 0) {
+        // the payload is in RAM, mask it in place
+        // (a user buffer is unmasked again after the write)
+        maskPayload(payloadPtr + WEBSOCKETS_MAX_HEADER_SIZE, length, maskKey);
+        maskInPlace = true;
     }
 
 #ifndef NODEBUG_WEBSOCKETS
@@ -303,23 +456,171 @@ bool WebSockets::sendFrame(WSclient_t * client, WSopcode_t opcode, uint8_t * pay
 
         if(payloadPtr && length > 0) {
             // send payload
-            if(write(client, &payloadPtr[0], length) != length) {
+            if(client->cIsClient) {
+                // mask while sending, no copy of the whole payload needed
+                if(writeMasked(client, &payloadPtr[0], length, maskKey) != length) {
+                    ret = false;
+                }
+            } else if(write(client, &payloadPtr[0], length) != length) {
                 ret = false;
             }
         }
     }
 
+    if(maskInPlace && !useInternBuffer) {
+        maskPayload(payloadPtr + WEBSOCKETS_MAX_HEADER_SIZE, length, maskKey);
+    }
+
     DEBUG_WEBSOCKETS("[WS][%d][sendFrame] sending Frame Done (%luus).\n", client->num, (micros() - start));
 
 #ifdef WEBSOCKETS_USE_BIG_MEM
     if(useInternBuffer && payloadPtr) {
-        free(payloadPtr);
+        packBufferBusy = false;
     }
 #endif
 
     return ret;
 }
 
+/**
+ * send a message in frames of max limits.maxSendFrameSize
+ * between the frames the control frames go out (heartbeat ping, pong for the pings of the peer)
+ * @param client WSclient_t *
+ * @param opcode WSopcode_t     WSop_text or WSop_binary
+ * @param payload uint8_t *     ptr to the payload (no reserved header space)
+ * @param length size_t
+ * @return true if ok
+ */
+bool WebSockets::sendFragmented(WSclient_t * client, WSopcode_t opcode, uint8_t * payload, size_t length) {
+    size_t fragment = client->limits.maxSendFrameSize;
+
+    DEBUG_WEBSOCKETS("[WS][%d][sendFragmented] %u byte in frames of %u\n", client->num, length, fragment);
+
+    while(length > 0) {
+        size_t n = std::min(length, fragment);
+        length -= n;
+        if(!sendFrame(client, opcode, payload, n, (length == 0))) {
+            return false;
+        }
+        payload += n;
+        opcode = WSop_continuation;
+
+        if(length > 0) {
+            client->cTxFragmenting = true;
+            handleControlFrames(client);
+            client->cTxFragmenting = false;
+        }
+    }
+    return true;
+}
+
+/**
+ * send a message read from a stream (file, flash, ...), only one chunk of WEBSOCKETS_STREAM_CHUNK_SIZE is in RAM
+ * known length: one frame (frames of limits.maxSendFrameSize if set)
+ * WEBSOCKETS_STREAM_UNTIL_END: one frame per chunk until stream.available() is 0
+ * control frames go out between the frames (see sendFragmented)
+ * @param client WSclient_t *
+ * @param opcode WSopcode_t     WSop_text or WSop_binary
+ * @param stream Stream &
+ * @param length size_t         payload length or WEBSOCKETS_STREAM_UNTIL_END
+ * @return true if ok, if the stream ends inside a frame the connection is dropped
+ */
+bool WebSockets::sendStream(WSclient_t * client, WSopcode_t opcode, Stream & stream, size_t length) {
+    if(client->status != WSC_CONNECTED || !clientIsConnected(client)) {
+        DEBUG_WEBSOCKETS("[WS][%d][sendStream] not connected!\n", client->num);
+        return false;
+    }
+
+    if(client->cTxFragmenting) {
+        DEBUG_WEBSOCKETS("[WS][%d][sendStream] fragmented send running, data frame refused!\n", client->num);
+        return false;
+    }
+
+    uint8_t chunk[WEBSOCKETS_STREAM_CHUNK_SIZE];
+    uint8_t maskKey[4];
+    bool untilEnd   = (length == WEBSOCKETS_STREAM_UNTIL_END);
+    size_t frameMax = (client->limits.maxSendFrameSize ? client->limits.maxSendFrameSize : length);
+    bool fin        = false;
+
+    DEBUG_WEBSOCKETS("[WS][%d][sendStream] length: %u\n", client->num, length);
+
+    while(!fin) {
+        size_t frameLen;
+        if(untilEnd) {
+            // the chunk is the frame, fin if the stream has nothing more
+            int available = stream.available();
+            frameLen      = stream.readBytes(chunk, std::min((size_t)std::max(available, 0), sizeof(chunk)));
+            fin           = (stream.available() <= 0);
+        } else {
+            frameLen = std::min(length, frameMax);
+            length -= frameLen;
+            fin = (length == 0);
+        }
+
+        if(!sendFrameHeader(client, opcode, frameLen, fin, maskKey)) {
+            return false;
+        }
+
+        size_t sent = 0;
+        while(sent < frameLen) {
+            size_t n = frameLen - sent;
+            if(!untilEnd) {
+                n = stream.readBytes(chunk, std::min(n, sizeof(chunk)));
+                if(n == 0) {
+                    // the peer waits for the rest of the frame, the connection can not be used anymore
+                    DEBUG_WEBSOCKETS("[WS][%d][sendStream] stream ended %u byte before the frame!\n", client->num, frameLen - sent);
+                    clientDisconnect(client);
+                    return false;
+                }
+            }
+            if(client->cIsClient) {
+                maskPayload(chunk, n, maskKey, sent);
+            }
+            if(write(client, chunk, n) != n) {
+                return false;
+            }
+            sent += n;
+        }
+
+        opcode = WSop_continuation;
+
+        if(!fin) {
+            client->cTxFragmenting = true;
+            handleControlFrames(client);
+            client->cTxFragmenting = false;
+        }
+    }
+    return true;
+}
+
+/**
+ * control frames that are due while a fragmented message is sent
+ * @param client WSclient_t *
+ */
+void WebSockets::handleControlFrames(WSclient_t * client) {
+    // heartbeat ping
+    if(client->pingInterval && (millis() - client->lastPing) > client->pingInterval) {
+        if(sendFrame(client, WSop_ping)) {
+            client->lastPing     = millis();
+            client->pongReceived = false;
+        }
+    }
+
+#if(WEBSOCKETS_NETWORK_TYPE != NETWORK_ESP8266_ASYNC)
+    // control frames of the peer (ping is answered, pong and close handled), data frames stay in the socket
+    // not if the send comes from an event of a received frame
+    for(uint8_t n = 0; n < WEBSOCKETS_MAX_FRAMES_PER_LOOP; n++) {
+        if(client->cWsRXsize != 0 || client->cRxPayload || !clientIsConnected(client)) {
+            break;
+        }
+        if(client->tcp->available() <= 0 || !(client->tcp->peek() & 0x08)) {
+            break;
+        }
+        handleWebsocketCb(client);
+    }
+#endif
+}
+
 /**
  * callen when HTTP header is done
  * @param client WSclient_t *  ptr to the client struct
@@ -328,12 +629,218 @@ void WebSockets::headerDone(WSclient_t * client) {
     client->status    = WSC_CONNECTED;
     client->cWsRXsize = 0;
     DEBUG_WEBSOCKETS("[WS][%d][headerDone] Header Handling Done.\n", client->num);
+    if(client->handshake) {
+        DEBUG_WEBSOCKETS("[WS][%d][headerDone] handshake arena used: %u/%u byte\n", client->num, client->handshake->arenaUsed, sizeof(client->handshake->arena));
+        handshakeReset(client);
+    }
 #if(WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP8266_ASYNC)
     client->cHttpLine = "";
     handleWebsocket(client);
 #endif
 }
 
+/**
+ * allocate from the handshake arena of the client
+ * @param client WSclient_t *
+ * @param size size_t
+ * @param heapFallback bool     use malloc if the arena is full
+ * @return buffer or NULL, give it back with handshakeRelease()
+ */
+char * WebSockets::handshakeAlloc(WSclient_t * client, size_t size, bool heapFallback) {
+    WSclientHandshake_t * hs = client->handshake;
+    // one byte always stays free for the 0 termination of the next header line
+    if(hs && size < (sizeof(hs->arena) - hs->arenaUsed)) {
+        char * buf = &hs->arena[hs->arenaUsed];
+        hs->arenaUsed += size;
+        return buf;
+    }
+    if(heapFallback) {
+        DEBUG_WEBSOCKETS("[WS][%d][handshakeAlloc] arena full, malloc %u byte\n", client->num, size);
+        return (char *)memAlloc(size);
+    }
+    DEBUG_WEBSOCKETS("[WS][%d][handshakeAlloc] arena full (%u byte needed)\n", client->num, size);
+    return NULL;
+}
+
+/**
+ * copy a string into the handshake arena
+ * the source may be the free part of the arena (in place parsed header line)
+ * @param client WSclient_t *
+ * @param str const char *
+ * @param length size_t
+ * @return 0 terminated copy or NULL if the arena is full
+ */
+char * WebSockets::handshakeStore(WSclient_t * client, const char * str, size_t length) {
+    char * buf = handshakeAlloc(client, length + 1);
+    if(buf) {
+        memmove(buf, str, length);
+        buf[length] = 0;
+    }
+    return buf;
+}
+
+/**
+ * give back a buffer from handshakeAlloc()
+ * arena buffers are released together with everything allocated after them
+ * @param client WSclient_t *
+ * @param buf char *
+ */
+void WebSockets::handshakeRelease(WSclient_t * client, char * buf) {
+    WSclientHandshake_t * hs = client->handshake;
+    if(hs && buf >= &hs->arena[0] && buf < &hs->arena[sizeof(hs->arena)]) {
+        hs->arenaUsed = buf - &hs->arena[0];
+    } else {
+        memFree(buf);
+    }
+}
+
+/**
+ * free all handshake temporaries in one step
+ * @param client WSclient_t *
+ */
+void WebSockets::handshakeReset(WSclient_t * client) {
+    if(!client->handshake) {
+        return;
+    }
+    client->handshake->cKey      = NULL;
+    client->handshake->cAccept   = NULL;
+    client->handshake->arenaUsed = 0;
+    client->handshake->cLine     = String();
+}
+
+#if(WEBSOCKETS_NETWORK_TYPE != NETWORK_ESP8266_ASYNC)
+/**
+ * read one header line into the free part of the handshake arena (not allocated)
+ * a line not fitting into the arena is continued in handshake->cLine
+ * the line is trimmed and 0 terminated
+ * @param client WSclient_t *
+ * @param length size_t *  length of the line
+ * @return line, valid until the next arena allocation / line, NULL if longer than WEBSOCKETS_MAX_HEADER_LINE_SIZE or no memory
+ */
+char * WebSockets::handshakeReadLine(WSclient_t * client, size_t * length) {
+    WSclientHandshake_t * hs = client->handshake;
+    *length                  = 0;
+    if(!hs) {
+        return NULL;
+    }
+    hs->cLine = String();
+
+    char * line = &hs->arena[hs->arenaUsed];
+    // one byte for the 0 termination
+    size_t size = sizeof(hs->arena) - hs->arenaUsed - 1;
+
+    size_t len = client->tcp->readBytesUntil('\n', line, size);
+    line[len]  = 0;
+
+    if(len >= size) {
+        // continue on the heap, a header is never truncated
+        char buf[64];
+        size_t n;
+        hs->cLine.reserve(len + sizeof(buf));
+        hs->cLine += line;
+        do {
+            n      = client->tcp->readBytesUntil('\n', buf, sizeof(buf) - 1);
+            buf[n] = 0;
+            hs->cLine += buf;
+            len += n;
+            if(len > WEBSOCKETS_MAX_HEADER_LINE_SIZE || hs->cLine.length() != len) {
+                DEBUG_WEBSOCKETS("[WS][%d][handshakeReadLine] line too long (%u byte)\n", client->num, len);
+                hs->cLine = String();
+                return NULL;
+            }
+        } while(n == sizeof(buf) - 1);
+        DEBUG_WEBSOCKETS("[WS][%d][handshakeReadLine] arena full, line of %u byte on the heap\n", client->num, len);
+        line = (char *)hs->cLine.c_str();
+    }
+
+    *length = len;
+    return trimLine(line, length);
+}
+#endif
+
+/**
+ * copy a header line into the free part of the handshake arena (not allocated)
+ * a line not fitting into the arena is moved to handshake->cLine
+ * @param client WSclient_t *
+ * @param line String *      cleared after the copy
+ * @param length size_t *   length of the line
+ * @return trimmed 0 terminated line, valid until the next arena allocation / line, NULL if longer than WEBSOCKETS_MAX_HEADER_LINE_SIZE
+ */
+char * WebSockets::handshakeLine(WSclient_t * client, String * line, size_t * length) {
+    WSclientHandshake_t * hs = client->handshake;
+    *length                  = 0;
+    if(!hs) {
+        return NULL;
+    }
+    hs->cLine = String();
+
+    size_t len = line->length();
+    char * buf;
+
+    if(len > WEBSOCKETS_MAX_HEADER_LINE_SIZE) {
+        DEBUG_WEBSOCKETS("[WS][%d][handshakeLine] line too long (%u byte)\n", client->num, len);
+        (*line) = "";
+        return NULL;
+    } else if(len < sizeof(hs->arena) - hs->arenaUsed) {
+        buf = &hs->arena[hs->arenaUsed];
+        memcpy(buf, line->c_str(), len);
+        buf[len] = 0;
+        (*line)  = "";
+    } else {
+        hs->cLine = std::move(*line);
+        (*line)   = "";
+        buf       = (char *)hs->cLine.c_str();
+    }
+
+    *length = len;
+    return trimLine(buf, length);
+}
+
+/**
+ * remove white space (\r) at the begin and end of a header line in place
+ * @param line char *
+ * @param length size_t *  updated
+ * @return begin of the trimmed line
+ */
+char * WebSockets::trimLine(char * line, size_t * length) {
+    size_t len = *length;
+    while(len > 0 && isspace((unsigned char)line[len - 1])) {
+        len--;
+    }
+    line[len] = 0;
+    while(len > 0 && isspace((unsigned char)*line)) {
+        line++;
+        len--;
+    }
+    *length = len;
+    return line;
+}
+
+/**
+ * append to a handshake buffer
+ * @param out char *     NULL to only measure the length
+ * @param pos size_t
+ * @param str const char *
+ * @param length size_t
+ * @return new pos
+ */
+size_t WebSockets::handshakeAppend(char * out, size_t pos, const char * str, size_t length) {
+    if(out) {
+        memcpy(&out[pos], str, length);
+    }
+    return pos + length;
+}
+
+#ifdef WEBSOCKETS_SAVE_RAM
+size_t WebSockets::handshakeAppend(char * out, size_t pos, const __FlashStringHelper * str) {
+    size_t length = strlen_P((PGM_P)str);
+    if(out) {
+        memcpy_P(&out[pos], (PGM_P)str, length);
+    }
+    return pos + length;
+}
+#endif
+
 /**
  * handle the WebSocket stream
  * @param client WSclient_t *  ptr to the client struct
@@ -364,6 +871,18 @@ bool WebSockets::handleWebsocketWaitFor(WSclient_t * client, size_t size) {
     }
 
     DEBUG_WEBSOCKETS("[WS][%d][handleWebsocketWaitFor] size: %d cWsRXsize: %d\n", client->num, size, client->cWsRXsize);
+#if(WEBSOCKETS_NETWORK_TYPE != NETWORK_ESP8266_ASYNC)
+    // blocking read, no callback needed
+    if(readCb(client, &client->cWsHeader[client->cWsRXsize], (size - client->cWsRXsize))) {
+        client->cWsRXsize = size;
+        return true;
+    }
+    DEBUG_WEBSOCKETS("[WS][%d][readCb] failed.\n", client->num);
+    client->cWsRXsize = 0;
+    // timeout or error
+    clientDisconnect(client, 1002);
+    return false;
+#else
     readCb(client, &client->cWsHeader[client->cWsRXsize], (size - client->cWsRXsize), std::bind([](WebSockets * server, size_t size, WSclient_t * client, bool ok) {
         DEBUG_WEBSOCKETS("[WS][%d][handleWebsocketWaitFor][readCb] size: %d ok: %d\n", client->num, size, ok);
         if(ok) {
@@ -378,6 +897,20 @@ bool WebSockets::handleWebsocketWaitFor(WSclient_t * client, size_t size) {
     },
                                                                                           this, size, std::placeholders::_1, std::placeholders::_2));
     return false;
+#endif
+}
+
+/**
+ * max payload of a message (all its frames)
+ * reassembled messages are always bounded (by maxFrameSize if maxMessageSize is not set)
+ * @param client WSclient_t *
+ * @return size_t
+ */
+static size_t messageLimit(WSclient_t * client) {
+    if(client->limits.maxMessageSize) {
+        return client->limits.maxMessageSize;
+    }
+    return client->cReassemble ? client->limits.maxFrameSize : (size_t)-1;
 }
 
 void WebSockets::handleWebsocketCb(WSclient_t * client) {
@@ -435,12 +968,26 @@ void WebSockets::handleWebsocketCb(WSclient_t * client) {
     DEBUG_WEBSOCKETS("[WS][%d][handleWebsocket] fin: %u rsv1: %u rsv2: %u rsv3 %u  opCode: %u\n", client->num, header->fin, header->rsv1, header->rsv2, header->rsv3, header->opCode);
     DEBUG_WEBSOCKETS("[WS][%d][handleWebsocket] mask: %u payloadLen: %u\n", client->num, header->mask, header->payloadLen);
 
-    if(header->payloadLen > WEBSOCKETS_MAX_DATA_SIZE) {
+    if(header->payloadLen > client->limits.maxFrameSize || header->payloadLen == 0xFFFFFFFF) {
         DEBUG_WEBSOCKETS("[WS][%d][handleWebsocket] payload too big! (%u)\n", client->num, header->payloadLen);
         clientDisconnect(client, 1009);
         return;
     }
 
+    if(!(header->opCode & 0x08)) {
+        // data frame, control frames do not belong to the message
+        if(header->opCode == WSop_continuation) {
+            client->cRxMessageLen += header->payloadLen;
+        } else {
+            client->cRxMessageLen = header->payloadLen;
+        }
+        if(client->cRxMessageLen > messageLimit(client)) {
+            DEBUG_WEBSOCKETS("[WS][%d][handleWebsocket] message too big! (%u)\n", client->num, client->cRxMessageLen);
+            clientDisconnect(client, 1009);
+            return;
+        }
+    }
+
     if(header->mask) {
         headerLen += 4;
         if(!handleWebsocketWaitFor(client, headerLen)) {
@@ -452,14 +999,27 @@ void WebSockets::handleWebsocketCb(WSclient_t * client) {
 
     if(header->payloadLen > 0) {
         // if text data we need one more
-        payload = (uint8_t *)malloc(header->payloadLen + 1);
+        payload             = provideBuffer(client, header->payloadLen + 1);
+        client->cRxProvided = (payload != NULL);
+        if(!payload) {
+            if(header->payloadLen >= client->cRxBufferSize && !memAvailable(header->payloadLen + 1)) {
+                DEBUG_WEBSOCKETS("[WS][%d][handleWebsocket] payload exceeds the memory budget (%u)\n", client->num, header->payloadLen);
+                clientDisconnect(client, 1009);
+                return;
+            }
+            payload = rxBuffer(client, header->payloadLen + 1);
+        }
 
         if(!payload) {
             DEBUG_WEBSOCKETS("[WS][%d][handleWebsocket] to less memory to handle payload %d!\n", client->num, header->payloadLen);
             clientDisconnect(client, 1011);
             return;
         }
+#if(WEBSOCKETS_NETWORK_TYPE != NETWORK_ESP8266_ASYNC)
+        handleWebsocketPayloadCb(client, readCb(client, payload, header->payloadLen), payload);
+#else
         readCb(client, payload, header->payloadLen, std::bind(&WebSockets::handleWebsocketPayloadCb, this, std::placeholders::_1, std::placeholders::_2, payload));
+#endif
     } else {
         handleWebsocketPayloadCb(client, true, NULL);
     }
@@ -473,19 +1033,24 @@ void WebSockets::handleWebsocketPayloadCb(WSclient_t * client, bool ok, uint8_t
 
             if(header->mask) {
                 // decode XOR
-                for(size_t i = 0; i < header->payloadLen; i++) {
-                    payload[i] = (payload[i] ^ header->maskKey[i % 4]);
-                }
+                maskPayload(payload, header->payloadLen, header->maskKey);
             }
         }
 
+        // the event callback can take the payload (detachPayload)
+        client->cRxPayload = payload;
+
         switch(header->opCode) {
             case WSop_text:
                 DEBUG_WEBSOCKETS("[WS][%d][handleWebsocket] text: %s\n", client->num, payload);
                 // fallthrough
             case WSop_binary:
             case WSop_continuation:
-                messageReceived(client, header->opCode, payload, header->payloadLen, header->fin);
+                if(client->cReassemble) {
+                    handleFragment(client, payload);
+                } else {
+                    messageReceived(client, header->opCode, payload, header->payloadLen, header->fin);
+                }
                 break;
             case WSop_ping:
                 // send pong back
@@ -519,9 +1084,12 @@ void WebSockets::handleWebsocketPayloadCb(WSclient_t * client, bool ok, uint8_t
                 break;
         }
 
-        if(payload) {
-            free(payload);
+        payload            = client->cRxPayload;
+        client->cRxPayload = NULL;
+        if(!client->cRxProvided) {
+            releaseRxBuffer(client, payload);
         }
+        client->cRxProvided = false;
 
         // reset input
         client->cWsRXsize = 0;
@@ -532,34 +1100,245 @@ void WebSockets::handleWebsocketPayloadCb(WSclient_t * client, bool ok, uint8_t
 
     } else {
         DEBUG_WEBSOCKETS("[WS][%d][handleWebsocket] missing data!\n", client->num);
-        free(payload);
+        if(!client->cRxProvided) {
+            releaseRxBuffer(client, payload);
+        }
+        client->cRxProvided = false;
         clientDisconnect(client, 1002);
     }
 }
 
+/**
+ * takes the payload of the running event, the library will not free it
+ * @param client WSclient_t *
+ * @return payload (release with releasePayload) or NULL if there is none
+ */
+uint8_t * WebSockets::detachPayload(WSclient_t * client) {
+    if(client->cRxProvided) {
+        // belongs to the application anyway
+        return NULL;
+    }
+    uint8_t * payload  = client->cRxPayload;
+    client->cRxPayload = NULL;
+    if(payload && payload == client->cMsgBuffer) {
+        // reassembled message, the next one gets a new buffer
+        client->cMsgBuffer     = NULL;
+        client->cMsgBufferSize = 0;
+    }
+    if(payload && payload == client->cRxBuffer) {
+        // the kept buffer goes to the application, the next frame gets a new one
+        client->cRxBuffer     = NULL;
+        client->cRxBufferSize = 0;
+    }
+    return payload;
+}
+
+/**
+ * get the receive buffer for a payload
+ * small payloads use the kept buffer of the connection (no allocation in the steady state)
+ * @param client WSclient_t *
+ * @param size size_t
+ * @return buffer or NULL, give it back with releaseRxBuffer()
+ */
+uint8_t * WebSockets::rxBuffer(WSclient_t * client, size_t size) {
+    if(size <= client->cRxBufferSize) {
+        return client->cRxBuffer;
+    }
+    if(size > WEBSOCKETS_RX_BUFFER_KEEP) {
+        return (uint8_t *)memAlloc(size);
+    }
+
+    // grow the kept buffer (in 32 byte steps to not grow on every frame)
+    freeRxBuffer(client);
+    size                  = std::min((size + 31) & ~((size_t)31), (size_t)WEBSOCKETS_RX_BUFFER_KEEP);
+    client->cRxBuffer     = (uint8_t *)memAlloc(size);
+    client->cRxBufferSize = client->cRxBuffer ? size : 0;
+    return client->cRxBuffer;
+}
+
+/**
+ * give back a buffer from rxBuffer()
+ * @param client WSclient_t *
+ * @param payload uint8_t *
+ */
+void WebSockets::releaseRxBuffer(WSclient_t * client, uint8_t * payload) {
+    if(payload != client->cRxBuffer) {
+        memFree(payload);
+    }
+}
+
+/**
+ * free the kept receive buffer (on disconnect)
+ * a buffer still used by a running event is freed by the event handling
+ * @param client WSclient_t *
+ */
+void WebSockets::freeRxBuffer(WSclient_t * client) {
+    if(client->cRxBuffer != client->cRxPayload) {
+        memFree(client->cRxBuffer);
+    }
+    client->cRxBuffer     = NULL;
+    client->cRxBufferSize = 0;
+}
+
+/**
+ * reassembly of fragmented messages (cReassemble)
+ * the fragments are collected in cMsgBuffer, the message is delivered like an unfragmented one
+ * control frames between the fragments are handled as usual
+ * @param client WSclient_t *
+ * @param payload uint8_t *  payload of the frame, released by the caller
+ */
+void WebSockets::handleFragment(WSclient_t * client, uint8_t * payload) {
+    WSMessageHeader_t * header = &client->cWsHeaderDecode;
+
+    if(header->opCode == WSop_continuation) {
+        if(client->cMsgOpcode == WSop_continuation) {
+            DEBUG_WEBSOCKETS("[WS][%d][handleFragment] continuation without a message!\n", client->num);
+            clientDisconnect(client, 1002);
+            return;
+        }
+    } else {
+        if(client->cMsgOpcode != WSop_continuation) {
+            DEBUG_WEBSOCKETS("[WS][%d][handleFragment] new message before the last one is done!\n", client->num);
+            clientDisconnect(client, 1002);
+            return;
+        }
+        if(header->fin) {
+            // not fragmented, no copy needed
+            messageReceived(client, header->opCode, payload, header->payloadLen, true);
+            return;
+        }
+        client->cMsgOpcode = header->opCode;
+        client->cMsgLen    = 0;
+    }
+
+    // + 1 for the 0 termination of text
+    if(!messageBuffer(client, client->cMsgLen + header->payloadLen + 1)) {
+        DEBUG_WEBSOCKETS("[WS][%d][handleFragment] to less memory to reassemble %u byte!\n", client->num, client->cMsgLen + header->payloadLen);
+        clientDisconnect(client, 1011);
+        return;
+    }
+    if(header->payloadLen > 0) {
+        memcpy(client->cMsgBuffer + client->cMsgLen, payload, header->payloadLen);
+        client->cMsgLen += header->payloadLen;
+    }
+
+    if(!header->fin) {
+        return;
+    }
+
+    uint8_t * message = client->cMsgBuffer;
+    size_t length     = client->cMsgLen;
+    WSopcode_t opcode = client->cMsgOpcode;
+
+    message[length]    = 0x00;
+    client->cMsgOpcode = WSop_continuation;
+    client->cMsgLen    = 0;
+
+    DEBUG_WEBSOCKETS("[WS][%d][handleFragment] message done (%u byte)\n", client->num, length);
+
+    // the frame is copied, give it back now (the message takes its place)
+    if(!client->cRxProvided) {
+        releaseRxBuffer(client, payload);
+    }
+    client->cRxProvided = false;
+
+    // the event callback can take the message (detachPayload)
+    client->cRxPayload = message;
+    messageReceived(client, opcode, message, length, true);
+    if(client->cRxPayload == message && message != client->cMsgBuffer) {
+        // disconnected in the event
+        memFree(message);
+    }
+    client->cRxPayload = NULL;
+
+    if(client->cMsgBufferSize > WEBSOCKETS_RX_BUFFER_KEEP) {
+        // do not hold big buffers between the messages
+        freeMessageBuffer(client);
+    }
+}
+
+/**
+ * grow the reassembly buffer (doubles the size to not copy on every fragment)
+ * @param client WSclient_t *
+ * @param size size_t  needed size
+ * @return true if ok
+ */
+bool WebSockets::messageBuffer(WSclient_t * client, size_t size) {
+    if(size <= client->cMsgBufferSize) {
+        return true;
+    }
+
+    size_t newSize = std::max(size, std::max(client->cMsgBufferSize * 2, (size_t)64));
+    // no need to grow past the limit (messageLimit is checked before the payload is read)
+    newSize = std::max(size, std::min(newSize, messageLimit(client) + 1));
+
+    uint8_t * buffer = (uint8_t *)memAlloc(newSize);
+    if(!buffer) {
+        return false;
+    }
+    if(client->cMsgLen > 0) {
+        memcpy(buffer, client->cMsgBuffer, client->cMsgLen);
+    }
+    memFree(client->cMsgBuffer);
+    client->cMsgBuffer     = buffer;
+    client->cMsgBufferSize = newSize;
+    return true;
+}
+
+/**
+ * free the reassembly buffer and drop a not finished message (on disconnect)
+ * a buffer still used by a running event is freed by handleFragment
+ * @param client WSclient_t *
+ */
+void WebSockets::freeMessageBuffer(WSclient_t * client) {
+    if(client->cMsgBuffer != client->cRxPayload) {
+        memFree(client->cMsgBuffer);
+    }
+    client->cMsgBuffer     = NULL;
+    client->cMsgBufferSize = 0;
+    client->cMsgLen        = 0;
+    client->cMsgOpcode     = WSop_continuation;
+}
+
 /**
  * generate the key for Sec-WebSocket-Accept
- * @param clientKey String
- * @return String Accept Key
+ * @param client WSclient_t *   the key is stored in the handshake arena of the client
+ * @param clientKey const char *
+ * @return Accept Key or NULL if the arena is full
  */
-String WebSockets::acceptKey(String & clientKey) {
+char * WebSockets::acceptKey(WSclient_t * client, const char * clientKey) {
+    static const char * GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+    if(!clientKey) {
+        return NULL;
+    }
+
+    size_t keyLen = strlen(clientKey);
+    char * data   = handshakeAlloc(client, keyLen + 36 + 1);
+    if(!data) {
+        return NULL;
+    }
+    memcpy(data, clientKey, keyLen);
+    memcpy(data + keyLen, GUID, 36);
+
     uint8_t sha1HashBin[20] = { 0 };
 #ifdef ESP8266
-    sha1(clientKey + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11", &sha1HashBin[0]);
+    sha1(data, keyLen + 36, &sha1HashBin[0]);
 #elif defined(ESP32)
-    String data = clientKey + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
-    esp_sha(SHA1, (unsigned char *)data.c_str(), data.length(), &sha1HashBin[0]);
+    esp_sha(SHA1, (unsigned char *)data, keyLen + 36, &sha1HashBin[0]);
 #else
-    clientKey += "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
     SHA1_CTX ctx;
     SHA1Init(&ctx);
-    SHA1Update(&ctx, (const unsigned char *)clientKey.c_str(), clientKey.length());
+    SHA1Update(&ctx, (const unsigned char *)data, keyLen + 36);
     SHA1Final(&sha1HashBin[0], &ctx);
 #endif
 
-    String key = base64_encode(sha1HashBin, 20);
-    key.trim();
-
+    // the key takes the place of the hash input
+    handshakeRelease(client, data);
+    char * key = handshakeAlloc(client, WEBSOCKETS_BASE64_SIZE(20));
+    if(key) {
+        base64_encode(sha1HashBin, 20, key);
+    }
     return key;
 }
 
@@ -572,7 +1351,7 @@ String WebSockets::acceptKey(String & clientKey) {
 String WebSockets::base64_encode(uint8_t * data, size_t length) {
     size_t size   = ((length * 1.6f) + 1);
     size          = std::max(size, (size_t)5);    // minimum buffer size
-    char * buffer = (char *)malloc(size);
+    char * buffer = (char *)memAlloc(size);
     if(buffer) {
         base64_encodestate _state;
         base64_init_encodestate(&_state);
@@ -580,21 +1359,44 @@ String WebSockets::base64_encode(uint8_t * data, size_t length) {
         len     = base64_encode_blockend((buffer + len), &_state);
 
         String base64 = String(buffer);
-        free(buffer);
+        memFree(buffer);
         return base64;
     }
     return String("-FAIL-");
 }
 
+/**
+ * base64_encode into a buffer
+ * @param data const uint8_t *
+ * @param length size_t
+ * @param out char *    needs WEBSOCKETS_BASE64_SIZE(length) byte
+ * @return length of the encoded string (without 0 termination)
+ */
+size_t WebSockets::base64_encode(const uint8_t * data, size_t length, char * out) {
+    base64_encodestate _state;
+    base64_init_encodestate(&_state);
+    int len = base64_encode_block((const char *)&data[0], length, &out[0], &_state);
+    len += base64_encode_blockend((out + len), &_state);
+    out[len] = 0;
+
+    // depending on the libb64 version the output ends with a new line
+    len = strlen(out);
+    while(len > 0 && (out[len - 1] == '\n' || out[len - 1] == '\r')) {
+        out[--len] = 0;
+    }
+    return len;
+}
+
 /**
  * read x byte from tcp or get timeout
  * @param client WSclient_t *
  * @param out  uint8_t * data buffer
  * @param n size_t byte count
+ * @param cb WSreadWaitCb called when done (async only)
  * @return true if ok
  */
-bool WebSockets::readCb(WSclient_t * client, uint8_t * out, size_t n, WSreadWaitCb cb) {
 #if(WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP8266_ASYNC)
+bool WebSockets::readCb(WSclient_t * client, uint8_t * out, size_t n, WSreadWaitCb cb) {
     if(!client->tcp || !client->tcp->connected()) {
         return false;
     }
@@ -606,32 +1408,26 @@ bool WebSockets::readCb(WSclient_t * client, uint8_t * out, size_t n, WSreadWait
     },
                                        client, std::placeholders::_1, cb));
 
+    return true;
+}
 #else
+bool WebSockets::readCb(WSclient_t * client, uint8_t * out, size_t n) {
     unsigned long t = millis();
     ssize_t len;
     DEBUG_WEBSOCKETS("[readCb] n: %zu t: %lu\n", n, t);
     while(n > 0) {
         if(client->tcp == NULL) {
             DEBUG_WEBSOCKETS("[readCb] tcp is null!\n");
-            if(cb) {
-                cb(client, false);
-            }
             return false;
         }
 
         if(!client->tcp->connected()) {
             DEBUG_WEBSOCKETS("[readCb] not connected!\n");
-            if(cb) {
-                cb(client, false);
-            }
             return false;
         }
 
-        if((millis() - t) > WEBSOCKETS_TCP_TIMEOUT) {
+        if((millis() - t) > client->limits.readTimeout) {
             DEBUG_WEBSOCKETS("[readCb] receive TIMEOUT! %lu\n", (millis() - t));
-            if(cb) {
-                cb(client, false);
-            }
             return false;
         }
 
@@ -653,13 +1449,10 @@ bool WebSockets::readCb(WSclient_t * client, uint8_t * out, size_t n, WSreadWait
             WEBSOCKETS_YIELD();
         }
     }
-    if(cb) {
-        cb(client, true);
-    }
     WEBSOCKETS_YIELD();
-#endif
     return true;
 }
+#endif
 
 /**
  * write x byte to tcp or get timeout
@@ -688,7 +1481,7 @@ size_t WebSockets::write(WSclient_t * client, uint8_t * out, size_t n) {
             break;
         }
 
-        if((millis() - t) > WEBSOCKETS_TCP_TIMEOUT) {
+        if((millis() - t) > client->limits.writeTimeout) {
             DEBUG_WEBSOCKETS("[write] write TIMEOUT! %lu\n", (millis() - t));
             break;
         }
@@ -719,6 +1512,116 @@ size_t WebSockets::write(WSclient_t * client, const char * out) {
     return write(client, (uint8_t *)out, strlen(out));
 }
 
+/**
+ * write a masked copy of the data, the data is not modified
+ * uses a small stack buffer (WEBSOCKETS_MASK_BUFFER_SIZE) for any size of data
+ * @param client WSclient_t *
+ * @param out const uint8_t *   data to send
+ * @param n size_t              length of the data
+ * @param maskKey uint8_t[4]    mask key of the frame
+ * @param offset size_t         position of the data in the frame payload
+ * @return bytes written
+ */
+size_t WebSockets::writeMasked(WSclient_t * client, const uint8_t * out, size_t n, const uint8_t maskKey[4], size_t offset) {
+    uint8_t buffer[WEBSOCKETS_MASK_BUFFER_SIZE];
+    size_t total = 0;
+
+    while(total < n) {
+        size_t len = std::min(n - total, sizeof(buffer));
+        memcpy(buffer, out + total, len);
+        maskPayload(buffer, len, maskKey, offset + total);
+        if(write(client, buffer, len) != len) {
+            break;
+        }
+        total += len;
+    }
+    return total;
+}
+
+/**
+ * creates a new mask key for a client frame
+ * the keys have to be unpredictable (RFC6455 5.3), the hardware rng is used where available.
+ * other platforms use a xorshift32 seeded once per connection, the state is never sent,
+ * it is mixed with the time of the frame and hashed
+ * @param client WSclient_t *
+ * @param maskKey uint8_t[4]    out
+ */
+void WebSockets::newMaskKey(WSclient_t * client, uint8_t maskKey[4]) {
+#if defined(ESP8266)
+    UNUSED(client);
+    uint32_t k = RANDOM_REG32;
+#elif defined(ESP32)
+    UNUSED(client);
+    uint32_t k = esp_random();
+#elif defined(ARDUINO_ARCH_RP2040)
+    UNUSED(client);
+    uint32_t k = rp2040.hwrand32();
+#else
+    uint32_t x = client->cMaskState;
+    if(x == 0) {
+        x = ((uint32_t)random(0x7FFFFFFF) << 1) ^ micros();
+        if(x == 0) {
+            x = 0x2545F491;
+        }
+    }
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    client->cMaskState = x;
+
+    // output mix (murmur3 finalizer)
+    uint32_t k = x ^ micros();
+    k ^= k >> 16;
+    k *= 0x85EBCA6B;
+    k ^= k >> 13;
+    k *= 0xC2B2AE35;
+    k ^= k >> 16;
+#endif
+
+    maskKey[0] = (k & 0xFF);
+    maskKey[1] = ((k >> 8) & 0xFF);
+    maskKey[2] = ((k >> 16) & 0xFF);
+    maskKey[3] = ((k >> 24) & 0xFF);
+}
+
+/**
+ * XOR the data with the mask key (masking and unmasking)
+ * works on 32 bit words for the aligned part of the data
+ * @param data uint8_t *
+ * @param length size_t
+ * @param maskKey uint8_t[4]
+ * @param offset size_t         position of data in the frame payload
+ */
+void WebSockets::maskPayload(uint8_t * data, size_t length, const uint8_t maskKey[4], size_t offset) {
+    typedef uint32_t __attribute__((__may_alias__)) word_t;
+    size_t x = 0;
+
+    // bytes until data is word aligned
+    while(x < length && ((uintptr_t)(data + x) & 3)) {
+        data[x] ^= maskKey[(offset + x) & 3];
+        x++;
+    }
+
+    if((length - x) >= 4) {
+        uint8_t key[4];
+        for(uint8_t i = 0; i < 4; i++) {
+            key[i] = maskKey[(offset + x + i) & 3];
+        }
+        word_t key32;
+        memcpy(&key32, key, sizeof(key32));
+
+        word_t * word = (word_t *)(data + x);
+        for(; (length - x) >= 4; x += 4) {
+            *word++ ^= key32;
+        }
+    }
+
+    while(x < length) {
+        data[x] ^= maskKey[(offset + x) & 3];
+        x++;
+    }
+}
+
 /**
  * enable ping/pong heartbeat process
  * @param client WSclient_t *
@@ -760,3 +1663,23 @@ void WebSockets::handleHBTimeout(WSclient_t * client) {
         }
     }
 }
+
+/**
+ * time until the next heartbeat action (ping or pong timeout) is due
+ * @param client WSclient_t *
+ * @return ms, WEBSOCKETS_NO_TIMEOUT if heartbeat is not active
+ */
+uint32_t WebSockets::nextHBTimeout(WSclient_t * client) {
+    if(client->pingInterval == 0 || client->status != WSC_CONNECTED) {
+        return WEBSOCKETS_NO_TIMEOUT;
+    }
+    uint32_t due = client->pingInterval;
+    if(!client->pongReceived && client->pongTimeout < due) {
+        due = client->pongTimeout;
+    }
+    uint32_t pi = millis() - client->lastPing;
+    if(pi > due) {
+        return 0;
+    }
+    return (due - pi) + 1;
+}
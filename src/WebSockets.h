@@ -38,6 +38,7 @@
 #error Use Version 1.x.x. (ATmega branch)
 #else
 #include <functional>
+#include <new>
 #endif
 
 #include "WebSocketsVersion.h"
@@ -125,6 +126,64 @@
 #define WEBSOCKETS_TCP_TIMEOUT (5000)
 #endif
 
+// returned by nextTimeout() if no timer is running
+#define WEBSOCKETS_NO_TIMEOUT (0xFFFFFFFFUL)
+
+#ifndef WEBSOCKETS_MAX_FRAMES_PER_LOOP
+// max frames / header lines handled per connection in one loop() call
+#define WEBSOCKETS_MAX_FRAMES_PER_LOOP (8)
+#endif
+
+#ifndef WEBSOCKETS_MASK_BUFFER_SIZE
+// stack buffer used to mask client payloads which can not be modified in place
+#ifdef WEBSOCKETS_USE_BIG_MEM
+#define WEBSOCKETS_MASK_BUFFER_SIZE (512)
+#else
+#define WEBSOCKETS_MASK_BUFFER_SIZE (64)
+#endif
+#endif
+
+#ifndef WEBSOCKETS_STREAM_CHUNK_SIZE
+// stack buffer of sendStream, the payload is copied from the stream to the network in chunks of this size
+#ifdef WEBSOCKETS_USE_BIG_MEM
+#define WEBSOCKETS_STREAM_CHUNK_SIZE (512)
+#else
+#define WEBSOCKETS_STREAM_CHUNK_SIZE (64)
+#endif
+#endif
+
+// length for sendStream: read until the stream has no more data available
+#define WEBSOCKETS_STREAM_UNTIL_END ((size_t)-1)
+
+#ifndef WEBSOCKETS_HANDSHAKE_ARENA_SIZE
+// bump allocated memory for the handshake temporaries (header line, keys, request / response)
+// header lines longer than the free arena are read to the heap
+#ifdef WEBSOCKETS_USE_BIG_MEM
+#define WEBSOCKETS_HANDSHAKE_ARENA_SIZE (1024)
+#elif defined(WEBSOCKETS_SAVE_RAM)
+#define WEBSOCKETS_HANDSHAKE_ARENA_SIZE (256)
+#else
+#define WEBSOCKETS_HANDSHAKE_ARENA_SIZE (512)
+#endif
+#endif
+
+#ifndef WEBSOCKETS_MAX_HEADER_LINE_SIZE
+// longest http header line of the handshake, a longer line fails the upgrade (server: 431)
+#define WEBSOCKETS_MAX_HEADER_LINE_SIZE (4096)
+#endif
+
+#ifndef WEBSOCKETS_RX_BUFFER_KEEP
+// receive buffers up to this size are kept per connection and reused for the next frames
+#ifdef WEBSOCKETS_USE_BIG_MEM
+#define WEBSOCKETS_RX_BUFFER_KEEP (1024)
+#else
+#define WEBSOCKETS_RX_BUFFER_KEEP (128)
+#endif
+#endif
+
+// buffer size needed by base64_encode() for len bytes (line breaks and 0 termination included)
+#define WEBSOCKETS_BASE64_SIZE(len) ((((len) + 2) / 3) * 4 + (len) / 54 + 3)
+
 #define NETWORK_ESP8266_ASYNC (0)
 #define NETWORK_ESP8266 (1)
 #define NETWORK_W5100 (2)
@@ -297,15 +356,18 @@
 // moves all Header strings to Flash (~300 Byte)
 #ifdef WEBSOCKETS_SAVE_RAM
 #define WEBSOCKETS_STRING(var) F(var)
+#define WEBSOCKETS_STRCASEEQ(str, var) (strcasecmp_P(str, PSTR(var)) == 0)
 #else
 #define WEBSOCKETS_STRING(var) var
+#define WEBSOCKETS_STRCASEEQ(str, var) (strcasecmp(str, var) == 0)
 #endif
 
 typedef enum {
     WSC_NOT_CONNECTED,
     WSC_HEADER,
     WSC_BODY,
-    WSC_CONNECTED
+    WSC_CONNECTED,
+    WSC_CLOSING    ///< close frame send, waiting for the close of the peer
 } WSclientsStatus_t;
 
 typedef enum {
@@ -347,6 +409,51 @@ typedef struct {
     uint8_t * maskKey;
 } WSMessageHeader_t;
 
+/**
+ * runtime limits of a connection, the defaults come from the config macros
+ * servers and clients copy their limits (setLimits) into each new connection,
+ * they can be changed for one connection in the WStype_CONNECTED event
+ */
+typedef struct {
+    size_t maxFrameSize       = WEBSOCKETS_MAX_DATA_SIZE;    ///< max payload of one frame
+    size_t maxMessageSize     = 0;                           ///< max payload of all frames of a message, 0 = no limit
+    uint32_t readTimeout      = WEBSOCKETS_TCP_TIMEOUT;      ///< ms without data before a started read fails
+    uint32_t writeTimeout     = WEBSOCKETS_TCP_TIMEOUT;      ///< ms without progress before a write fails
+    uint32_t handshakeTimeout = WEBSOCKETS_TCP_TIMEOUT;      ///< ms from the connect until the upgrade is done
+    size_t maxSendFrameSize   = 0;                           ///< bigger outgoing messages are split into frames, 0 = one frame
+} WSlimits_t;
+
+/**
+ * http upgrade data of a connection
+ * only allocated while the handshake runs, freed once the upgrade is done or failed
+ */
+typedef struct {
+    String cUrl;                 ///< http url
+    String cSessionId;           ///< client Set-Cookie (session id)
+    char * cKey    = nullptr;    ///< client Sec-WebSocket-Key (in the arena)
+    char * cAccept = nullptr;    ///< client Sec-WebSocket-Accept (in the arena)
+    String cProtocol;            ///< client Sec-WebSocket-Protocol
+    String cExtensions;          ///< client Sec-WebSocket-Extensions
+
+    String base64Authorization;    ///< Base64 encoded Auth request
+
+    size_t cMandatoryHeadersCount = 0;    ///< non-websocket mandatory http headers present count
+
+    uint16_t cCode    = 0;        ///< http code
+    uint16_t cVersion = 0;        ///< client Sec-WebSocket-Version
+    bool cIsUpgrade   = false;    ///< Connection == Upgrade
+    bool cIsWebsocket = false;    ///< Upgrade == websocket
+
+    bool cHttpHeadersValid = false;    ///< non-websocket http header validity indicator
+
+    uint32_t cStart = 0;    ///< millis of the connect (handshake deadline)
+
+    String cLine;    ///< header line too long for the arena
+
+    size_t arenaUsed = 0;                           ///< bytes handed out from the arena
+    char arena[WEBSOCKETS_HANDSHAKE_ARENA_SIZE];    ///< handshake temporaries, reset in one step by handshakeReset()
+} WSclientHandshake_t;
+
 typedef struct {
     void init(uint8_t num,
         uint32_t pingInterval,
@@ -358,51 +465,51 @@ typedef struct {
         this->disconnectTimeoutCount = disconnectTimeoutCount;
     }
 
-    uint8_t num = 0;    ///< connection number
+    WEBSOCKETS_NETWORK_CLASS * tcp = nullptr;
+
+#if defined(HAS_SSL)
+    WEBSOCKETS_NETWORK_SSL_CLASS * ssl = nullptr;
+#endif
+
+    WSclientHandshake_t * handshake = nullptr;    ///< http upgrade data, NULL when not needed
 
     WSclientsStatus_t status = WSC_NOT_CONNECTED;
 
-    WEBSOCKETS_NETWORK_CLASS * tcp = nullptr;
+    uint8_t num = 0;    ///< connection number
 
     bool isSocketIO = false;    ///< client for socket.io server
-
 #if defined(HAS_SSL)
     bool isSSL = false;    ///< run in ssl mode
-    WEBSOCKETS_NETWORK_SSL_CLASS * ssl;
 #endif
+    bool cIsClient = false;    ///< will be used for masking
 
-    String cUrl;           ///< http url
-    uint16_t cCode = 0;    ///< http code
+    uint32_t cMaskState = 0;    ///< xorshift32 state for the mask keys (no hardware rng), 0 = not seeded
 
-    bool cIsClient    = false;    ///< will be used for masking
-    bool cIsUpgrade   = false;    ///< Connection == Upgrade
-    bool cIsWebsocket = false;    ///< Upgrade == websocket
+    WSlimits_t limits;              ///< limits of this connection
+    bool cTxFragmenting = false;    ///< a fragmented send is between two frames, other data frames are refused
 
-    String cSessionId;        ///< client Set-Cookie (session id)
-    String cKey;              ///< client Sec-WebSocket-Key
-    String cAccept;           ///< client Sec-WebSocket-Accept
-    String cProtocol;         ///< client Sec-WebSocket-Protocol
-    String cExtensions;       ///< client Sec-WebSocket-Extensions
-    uint16_t cVersion = 0;    ///< client Sec-WebSocket-Version
+    WSMessageHeader_t cWsHeaderDecode;
+    uint8_t * cRxPayload = nullptr;    ///< payload of the running event, freed after the event if not detached
+    bool cRxProvided     = false;      ///< cRxPayload is from the buffer provider (not freed by the library)
+    uint8_t * cRxBuffer  = nullptr;    ///< kept receive buffer (up to WEBSOCKETS_RX_BUFFER_KEEP)
+    size_t cRxBufferSize = 0;          ///< size of cRxBuffer
+    size_t cRxMessageLen = 0;          ///< payload received for the running message (all its frames)
+
+    bool cReassemble      = false;                ///< deliver fragmented messages in one piece
+    WSopcode_t cMsgOpcode = WSop_continuation;    ///< opcode of the message in reassembly, WSop_continuation = none
+    uint8_t * cMsgBuffer  = nullptr;              ///< reassembly buffer (kept up to WEBSOCKETS_RX_BUFFER_KEEP)
+    size_t cMsgBufferSize = 0;                    ///< size of cMsgBuffer
+    size_t cMsgLen        = 0;                    ///< bytes in cMsgBuffer
 
     uint8_t cWsRXsize = 0;                            ///< State of the RX
     uint8_t cWsHeader[WEBSOCKETS_MAX_HEADER_SIZE];    ///< RX WS Message buffer
-    WSMessageHeader_t cWsHeaderDecode;
-
-    String base64Authorization;    ///< Base64 encoded Auth request
-    String plainAuthorization;     ///< Base64 encoded Auth request
-
-    String extraHeaders;
-
-    bool cHttpHeadersValid = false;    ///< non-websocket http header validity indicator
-    size_t cMandatoryHeadersCount;     ///< non-websocket mandatory http headers present count
 
     bool pongReceived              = false;
+    uint8_t disconnectTimeoutCount = 0;    // after how many subsequent pong timeouts discconnect will happen, 0 means "do not disconnect"
+    uint8_t pongTimeoutCount       = 0;    // current pong timeout count
     uint32_t pingInterval          = 0;    // how often ping will be sent, 0 means "heartbeat is not active"
     uint32_t lastPing              = 0;    // millis when last pong has been received
     uint32_t pongTimeout           = 0;    // interval in millis after which pong is considered to timeout
-    uint8_t disconnectTimeoutCount = 0;    // after how many subsequent pong timeouts discconnect will happen, 0 means "do not disconnect"
-    uint8_t pongTimeoutCount       = 0;    // current pong timeout count
 
 #if(WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP8266_ASYNC)
     String cHttpLine;    ///< HTTP header lines
@@ -410,11 +517,63 @@ typedef struct {
 
 } WSclient_t;
 
+typedef void * (*WSmallocFunc)(size_t size);
+typedef void (*WSfreeFunc)(void * ptr);
+
+// frees a payload handed to the client with WebSocketsClient::sendTXTOwned / sendBINOwned
+typedef void (*WSpayloadDeleter)(uint8_t * payload);
+
+/**
+ * memory used by the library, see WebSockets::getMemoryStats()
+ */
+typedef struct {
+    size_t used;         ///< byte currently allocated
+    size_t peak;         ///< high-water mark of used
+    size_t budget;       ///< configured budget, 0 = unlimited
+    uint32_t allocs;     ///< allocations done (for checking the steady state is allocation free)
+    uint32_t refused;    ///< allocations refused because of the budget
+    uint32_t failed;     ///< allocations the allocator could not serve
+} WSmemoryStats_t;
+
 class WebSockets {
+  public:
+    static void setAllocator(WSmallocFunc mallocFunc, WSfreeFunc freeFunc);
+    static void setMemoryBudget(size_t budget);
+    static WSmemoryStats_t getMemoryStats(void);
+
   protected:
-#ifdef __AVR__
-    typedef void (*WSreadWaitCb)(WSclient_t * client, bool ok);
-#else
+    friend class WebSocketsFrameWriter;
+
+    static void * memAlloc(size_t size);
+    static void memFree(void * ptr);
+    static bool memAvailable(size_t size);
+
+    /**
+     * new for objects owned by the library (allocated with memAlloc)
+     * @return object or NULL if there is no memory
+     */
+    template<typename T, typename... Args>
+    static T * memNew(Args &&... args) {
+        void * mem = memAlloc(sizeof(T));
+        if(!mem) {
+            return NULL;
+        }
+        return new(mem) T(static_cast<Args &&>(args)...);
+    }
+
+    /**
+     * delete for objects created with memNew
+     */
+    template<typename T>
+    static void memDelete(T * obj) {
+        if(obj) {
+            obj->~T();
+            memFree(obj);
+        }
+    }
+
+#if(WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP8266_ASYNC)
+    // only the async transport needs a callback, the blocking ones read with direct calls
     typedef std::function<void(WSclient_t * client, bool ok)> WSreadWaitCb;
 #endif
 
@@ -422,12 +581,16 @@ class WebSockets {
     virtual bool clientIsConnected(WSclient_t * client) = 0;
 
     void clientDisconnect(WSclient_t * client, uint16_t code, char * reason = NULL, size_t reasonLen = 0);
+    bool clientClose(WSclient_t * client, uint16_t code);
 
     virtual void messageReceived(WSclient_t * client, WSopcode_t opcode, uint8_t * payload, size_t length, bool fin) = 0;
 
     uint8_t createHeader(uint8_t * buf, WSopcode_t opcode, size_t length, bool mask, uint8_t maskKey[4], bool fin);
-    bool sendFrameHeader(WSclient_t * client, WSopcode_t opcode, size_t length = 0, bool fin = true);
+    bool sendFrameHeader(WSclient_t * client, WSopcode_t opcode, size_t length = 0, bool fin = true, uint8_t * maskKey = NULL);
     bool sendFrame(WSclient_t * client, WSopcode_t opcode, uint8_t * payload = NULL, size_t length = 0, bool fin = true, bool headerToPayload = false);
+    bool sendFragmented(WSclient_t * client, WSopcode_t opcode, uint8_t * payload, size_t length);
+    bool sendStream(WSclient_t * client, WSopcode_t opcode, Stream & stream, size_t length);
+    void handleControlFrames(WSclient_t * client);
 
     void headerDone(WSclient_t * client);
 
@@ -437,15 +600,70 @@ class WebSockets {
     void handleWebsocketCb(WSclient_t * client);
     void handleWebsocketPayloadCb(WSclient_t * client, bool ok, uint8_t * payload);
 
-    String acceptKey(String & clientKey);
+    uint8_t * detachPayload(WSclient_t * client);
+
+#ifdef WEBSOCKETS_USE_BIG_MEM
+    static uint8_t * packBuffer(size_t size);
+#endif
+    uint8_t * rxBuffer(WSclient_t * client, size_t size);
+    void releaseRxBuffer(WSclient_t * client, uint8_t * payload);
+    void freeRxBuffer(WSclient_t * client);
+
+    void handleFragment(WSclient_t * client, uint8_t * payload);
+    bool messageBuffer(WSclient_t * client, size_t size);
+    void freeMessageBuffer(WSclient_t * client);
+
+    /**
+     * called to get the buffer for a received payload
+     * Note: can be override
+     * @param client WSclient_t *
+     * @param size size_t   payload length + 1 (for the 0 termination)
+     * @return buffer or NULL to use malloc
+     */
+    virtual uint8_t * provideBuffer(WSclient_t * client, size_t size) {
+        return NULL;
+    }
+
+    char * handshakeAlloc(WSclient_t * client, size_t size, bool heapFallback = false);
+    char * handshakeStore(WSclient_t * client, const char * str, size_t length);
+    void handshakeRelease(WSclient_t * client, char * buf);
+    void handshakeReset(WSclient_t * client);
+#if(WEBSOCKETS_NETWORK_TYPE != NETWORK_ESP8266_ASYNC)
+    char * handshakeReadLine(WSclient_t * client, size_t * length);
+#endif
+    char * handshakeLine(WSclient_t * client, String * line, size_t * length);
+    static char * trimLine(char * line, size_t * length);
+
+    static size_t handshakeAppend(char * out, size_t pos, const char * str, size_t length);
+    static size_t handshakeAppend(char * out, size_t pos, const char * str) {
+        return handshakeAppend(out, pos, str, strlen(str));
+    }
+    static size_t handshakeAppend(char * out, size_t pos, const String & str) {
+        return handshakeAppend(out, pos, str.c_str(), str.length());
+    }
+#ifdef WEBSOCKETS_SAVE_RAM
+    static size_t handshakeAppend(char * out, size_t pos, const __FlashStringHelper * str);
+#endif
+
+    char * acceptKey(WSclient_t * client, const char * clientKey);
     String base64_encode(uint8_t * data, size_t length);
+    size_t base64_encode(const uint8_t * data, size_t length, char * out);
 
+#if(WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP8266_ASYNC)
     bool readCb(WSclient_t * client, uint8_t * out, size_t n, WSreadWaitCb cb);
+#else
+    bool readCb(WSclient_t * client, uint8_t * out, size_t n);
+#endif
     virtual size_t write(WSclient_t * client, uint8_t * out, size_t n);
     size_t write(WSclient_t * client, const char * out);
+    size_t writeMasked(WSclient_t * client, const uint8_t * out, size_t n, const uint8_t maskKey[4], size_t offset = 0);
+
+    void newMaskKey(WSclient_t * client, uint8_t maskKey[4]);
+    void maskPayload(uint8_t * data, size_t length, const uint8_t maskKey[4], size_t offset = 0);
 
     void enableHeartbeat(WSclient_t * client, uint32_t pingInterval, uint32_t pongTimeout, uint8_t disconnectTimeoutCount);
     void handleHBTimeout(WSclient_t * client);
+    uint32_t nextHBTimeout(WSclient_t * client);
 };
 
 #ifndef UNUSED
@@ -54,7 +54,7 @@ class WebSockets4WebServer : public WebSocketsServerCore {
             }
 
             // allocate a WiFiClient copy (like in WebSocketsServer::handleNewClients())
-            WEBSOCKETS_NETWORK_CLASS * newTcpClient = new WEBSOCKETS_NETWORK_CLASS(*tcpClient);
+            WEBSOCKETS_NETWORK_CLASS * newTcpClient = memNew<WEBSOCKETS_NETWORK_CLASS>(*tcpClient);
 
             // Then initialize a new WSclient_t (like in WebSocketsServer::handleNewClient())
             WSclient_t * client = handleNewClient(newTcpClient);
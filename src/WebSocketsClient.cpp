@@ -24,19 +24,104 @@
 
 #include "WebSockets.h"
 #include "WebSocketsClient.h"
+#include "WebSocketsClientGroup.h"
 
 WebSocketsClient::WebSocketsClient() {
-    _cbEvent             = NULL;
-    _client.num          = 0;
-    _client.cIsClient    = true;
-    _client.extraHeaders = WEBSOCKETS_STRING("Origin: file://");
-    _reconnectInterval   = 500;
-    _port                = 0;
-    _host                = "";
+    _cbEvent              = NULL;
+    _cbEventArg           = NULL;
+    _cbEventArgPtr        = NULL;
+    _cbBuffer             = NULL;
+    _client.num           = 0;
+    _client.cIsClient     = true;
+    _reconnectInterval    = 500;
+    _reconnectIntervalMax = 0;
+    _reconnectStableTime  = 10000;
+    _reconnectDelay       = _reconnectInterval;
+    _reconnectFailures    = 0;
+    _connectedSince       = 0;
+    _hostCount            = 0;
+    _hostIndex            = 0;
+    _failoverThreshold    = 3;
+    _dnsCacheTTL          = WEBSOCKETS_CLIENT_DNS_CACHE_TTL;
+    _connectTimeout       = WEBSOCKETS_TCP_TIMEOUT;
+    _reassemble           = false;
+    _connectPending       = false;
+    _networkConfigured    = false;
+    _disconnectTime       = 0;
+    _queueHead            = NULL;
+    _queueTail            = NULL;
+    _queueCount           = 0;
+    _queueBytes           = 0;
+    _queueMaxMessages     = 0;
+    _queueMaxBytes        = 0;
+    _queueMaxAge          = 0;
+    _queueDrop            = WSqueueDrop_oldest;
+    _group                = NULL;
+    _groupNext            = NULL;
+    _groupWake            = 0;
+    _port                 = 0;
+    _host                 = "";
+    _extraHeaders         = WEBSOCKETS_STRING("Origin: file://");
+    memset(&_stats, 0x00, sizeof(_stats));
+
+#if(WEBSOCKETS_NETWORK_TYPE != NETWORK_ESP8266_ASYNC)
+    _tcpIdle = NULL;
+#if defined(HAS_SSL)
+    _sslIdle = NULL;
+#endif
+#endif
 }
 
 WebSocketsClient::~WebSocketsClient() {
+#if(WEBSOCKETS_NETWORK_TYPE != NETWORK_ESP8266_ASYNC)
+    if(_group) {
+        _group->remove(this);
+    }
+#endif
     disconnect();
+    clearSendQueue();
+
+#if(WEBSOCKETS_NETWORK_TYPE != NETWORK_ESP8266_ASYNC)
+#if(WEBSOCKETS_NETWORK_TYPE == NETWORK_WIFI_NINA) || (WEBSOCKETS_NETWORK_TYPE == NETWORK_SAMD_SEED) || (WEBSOCKETS_NETWORK_TYPE == NETWORK_UNOWIFIR4)
+    // does not support delete (no destructor)
+#else
+    if(_tcpIdle) {
+        memDelete(_tcpIdle);
+    }
+#if defined(HAS_SSL)
+    if(_sslIdle) {
+        memDelete(_sslIdle);
+    }
+#endif
+#endif
+#endif
+
+    freeHandshake();
+}
+
+/**
+ * allocates the handshake data of the connection
+ * it only exists from the connect until the upgrade is done or failed
+ * @return false if there is no memory for it
+ */
+bool WebSocketsClient::initHandshake(void) {
+    if(_client.handshake) {
+        return true;
+    }
+    _client.handshake = memNew<WSclientHandshake_t>();
+    if(!_client.handshake) {
+        DEBUG_WEBSOCKETS("[WS-Client] no memory for the handshake data\n");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * frees the handshake data of the connection
+ */
+void WebSocketsClient::freeHandshake(void) {
+    memDelete(_client.handshake);
+    _client.handshake = NULL;
 }
 
 /**
@@ -45,6 +130,10 @@ WebSocketsClient::~WebSocketsClient() {
 void WebSocketsClient::begin(const char * host, uint16_t port, const char * url, const char * protocol) {
     _host = host;
     _port = port;
+
+    resetHost(&_hosts[0], host, port);
+    _hostCount = 1;
+    _hostIndex = 0;
 #if defined(HAS_SSL)
     _fingerprint = SSL_FINGERPRINT_NULL;
     _CA_cert     = NULL;
@@ -63,18 +152,12 @@ void WebSocketsClient::begin(const char * host, uint16_t port, const char * url,
     _client.isSSL = false;
     _client.ssl   = NULL;
 #endif
-    _client.cUrl                = url;
-    _client.cCode               = 0;
-    _client.cIsUpgrade          = false;
-    _client.cIsWebsocket        = true;
-    _client.cKey                = "";
-    _client.cAccept             = "";
-    _client.cProtocol           = protocol;
-    _client.cExtensions         = "";
-    _client.cVersion            = 0;
-    _client.base64Authorization = "";
-    _client.plainAuthorization  = "";
-    _client.isSocketIO          = false;
+    _url                 = url;
+    _protocol            = protocol;
+    _base64Authorization = "";
+    _plainAuthorization  = "";
+    _client.isSocketIO   = false;
+    freeHandshake();
 
     _client.lastPing         = 0;
     _client.pongReceived     = false;
@@ -94,6 +177,16 @@ void WebSocketsClient::begin(const char * host, uint16_t port, const char * url,
 
     _lastConnectionFail = 0;
     _lastHeaderSent     = 0;
+    _connectPending     = false;
+    _reconnectFailures  = 0;
+    _reconnectDelay     = _reconnectInterval;
+    _disconnectTime     = 0;
+
+    // tls settings may change, the kept network class needs to be configured again
+    _networkConfigured = false;
+#if defined(SSL_BARESSL)
+    _sslSession = BearSSL::Session();
+#endif
 
     DEBUG_WEBSOCKETS("[WS-Client] Websocket Version: " WEBSOCKETS_VERSION "\n");
 }
@@ -172,8 +265,9 @@ void WebSocketsClient::setSSLClientCertKey(const char * clientCert, const char *
 }
 
 void WebSocketsClient::setSSLClientCertKey(BearSSL::X509List * clientCert, BearSSL::PrivateKey * clientPrivateKey) {
-    _client_cert = clientCert;
-    _client_key  = clientPrivateKey;
+    _client_cert       = clientCert;
+    _client_key        = clientPrivateKey;
+    _networkConfigured = false;
 }
 #endif    // SSL_BARESSL
 
@@ -233,105 +327,239 @@ void WebSocketsClient::loop(void) {
     if(_port == 0) {
         return;
     }
-    WEBSOCKETS_YIELD();
+    yieldLoop();
+    if(_connectPending) {
+        handleConnect();
+        return;
+    }
     if(!clientIsConnected(&_client)) {
         // do not flood the server
-        if((millis() - _lastConnectionFail) < _reconnectInterval) {
+        if((millis() - _lastConnectionFail) < _reconnectDelay) {
             return;
         }
 
 #if defined(HAS_SSL)
         if(_client.isSSL) {
             DEBUG_WEBSOCKETS("[WS-Client] connect wss...\n");
-            if(_client.ssl) {
-#if(WEBSOCKETS_NETWORK_TYPE == NETWORK_WIFI_NINA) || (WEBSOCKETS_NETWORK_TYPE == NETWORK_SAMD_SEED) || (WEBSOCKETS_NETWORK_TYPE == NETWORK_UNOWIFIR4)
-                // does not support delete (no destructor)
-#else
-                delete _client.ssl;
-#endif
-
-                _client.ssl = NULL;
-                _client.tcp = NULL;
+            bool configure = !_networkConfigured;
+            if(_sslIdle) {
+                // reuse the network class of the last connection
+                _client.ssl = _sslIdle;
+                _sslIdle    = NULL;
+                _stats.networkReuses++;
+            } else {
+                _client.ssl = memNew<WEBSOCKETS_NETWORK_SSL_CLASS>();
+                configure   = true;
             }
-            _client.ssl = new WEBSOCKETS_NETWORK_SSL_CLASS();
             _client.tcp = _client.ssl;
-            if(_CA_cert) {
-                DEBUG_WEBSOCKETS("[WS-Client] setting CA certificate");
+            if(configure && _client.ssl) {
+                _networkConfigured = true;
+                if(_CA_cert) {
+                    DEBUG_WEBSOCKETS("[WS-Client] setting CA certificate");
 #if defined(ESP32)
-                _client.ssl->setCACert(_CA_cert);
+                    _client.ssl->setCACert(_CA_cert);
 #elif defined(ESP8266) && defined(SSL_AXTLS)
-                _client.ssl->setCACert((const uint8_t *)_CA_cert, strlen(_CA_cert) + 1);
+                    _client.ssl->setCACert((const uint8_t *)_CA_cert, strlen(_CA_cert) + 1);
 #elif(defined(ESP8266) || defined(ARDUINO_ARCH_RP2040)) && defined(SSL_BARESSL)
-                _client.ssl->setTrustAnchors(_CA_cert);
+                    _client.ssl->setTrustAnchors(_CA_cert);
 #elif defined(WIO_TERMINAL) || defined(SEEED_XIAO_M0)
-                _client.ssl->setCACert(_CA_cert);
+                    _client.ssl->setCACert(_CA_cert);
 #elif defined(ARDUINO_SAMD_MKRWIFI1010) || defined(ARDUINO_SAMD_NANO_33_IOT)
-                // no setCACert
+                    // no setCACert
 #else
 #error setCACert not implemented
 #endif
 #if defined(ESP32)
-            } else if(_CA_bundle) {
-                DEBUG_WEBSOCKETS("[WS-Client] setting CA bundle");
+                } else if(_CA_bundle) {
+                    DEBUG_WEBSOCKETS("[WS-Client] setting CA bundle");
 #if ESP_ARDUINO_VERSION >= ESP_ARDUINO_VERSION_VAL(3, 0, 4)
-                _client.ssl->setCACertBundle(_CA_bundle, _CA_bundle_size);
+                    _client.ssl->setCACertBundle(_CA_bundle, _CA_bundle_size);
 #else
-                _client.ssl->setCACertBundle(_CA_bundle);
+                    _client.ssl->setCACertBundle(_CA_bundle);
 #endif
-            } else if(!SSL_FINGERPRINT_IS_SET) {
-                _client.ssl->setInsecure();
+                } else if(!SSL_FINGERPRINT_IS_SET) {
+                    _client.ssl->setInsecure();
 #elif defined(SSL_BARESSL)
-            } else if(SSL_FINGERPRINT_IS_SET) {
-                _client.ssl->setFingerprint(_fingerprint);
-            } else {
-                _client.ssl->setInsecure();
-            }
-            if(_client_cert && _client_key) {
-                _client.ssl->setClientRSACert(_client_cert, _client_key);
-                DEBUG_WEBSOCKETS("[WS-Client] setting client certificate and key");
+                } else if(SSL_FINGERPRINT_IS_SET) {
+                    _client.ssl->setFingerprint(_fingerprint);
+                } else {
+                    _client.ssl->setInsecure();
+                }
+                if(_client_cert && _client_key) {
+                    _client.ssl->setClientRSACert(_client_cert, _client_key);
+                    DEBUG_WEBSOCKETS("[WS-Client] setting client certificate and key");
+#endif
+                }
+#if defined(SSL_BARESSL)
+                // resume the tls session of the last connection (saves the full handshake)
+                _client.ssl->setSession(&_sslSession);
 #endif
             }
         } else {
             DEBUG_WEBSOCKETS("[WS-Client] connect ws...\n");
-            if(_client.tcp) {
-#if(WEBSOCKETS_NETWORK_TYPE == NETWORK_WIFI_NINA) || (WEBSOCKETS_NETWORK_TYPE == NETWORK_SAMD_SEED) || (WEBSOCKETS_NETWORK_TYPE == NETWORK_UNOWIFIR4)
-                // does not support delete (no destructor)
-#else
-                delete _client.tcp;
-#endif
-                _client.tcp = NULL;
+            if(_tcpIdle) {
+                _client.tcp = _tcpIdle;
+                _tcpIdle    = NULL;
+                _stats.networkReuses++;
+            } else {
+                _client.tcp = memNew<WEBSOCKETS_NETWORK_CLASS>();
             }
-            _client.tcp = new WEBSOCKETS_NETWORK_CLASS();
         }
 #else
-        _client.tcp = new WEBSOCKETS_NETWORK_CLASS();
+        if(_tcpIdle) {
+            _client.tcp = _tcpIdle;
+            _tcpIdle    = NULL;
+            _stats.networkReuses++;
+        } else {
+            _client.tcp = memNew<WEBSOCKETS_NETWORK_CLASS>();
+        }
 #endif
 
         if(!_client.tcp) {
             DEBUG_WEBSOCKETS("[WS-Client] creating Network class failed!");
             return;
         }
-        WEBSOCKETS_YIELD();
-#if defined(ESP32)
-        if(_client.tcp->connect(_host.c_str(), _port, WEBSOCKETS_TCP_TIMEOUT)) {
-#else
-        if(_client.tcp->connect(_host.c_str(), _port)) {
-#endif
-            connectedCb();
-            _lastConnectionFail = 0;
-        } else {
-            connectFailedCb();
-            _lastConnectionFail = millis();
-        }
+
+        // the connect is done on the next loop() call,
+        // this gives the application a chance to run between the phases
+        _connectPending = true;
     } else {
         handleClientData();
-        WEBSOCKETS_YIELD();
+        yieldLoop();
         if(_client.status == WSC_CONNECTED) {
+            handleSendQueue(WEBSOCKETS_CLIENT_QUEUE_BATCH);
             handleHBPing();
             handleHBTimeout(&_client);
         }
     }
 }
+
+/**
+ * connect phase of loop(), the network class is already prepared
+ * blocks for max _connectTimeout (if supported by the network class),
+ * dns and the tls handshake are part of the blocking connect call
+ */
+void WebSocketsClient::handleConnect(void) {
+    _connectPending = false;
+
+    if(!_client.tcp) {
+        return;
+    }
+
+    WSclientHost_t * host = &_hosts[_hostIndex];
+    bool useAddress       = hostAddressValid(host);
+    bool ok;
+
+#if defined(HAS_SSL)
+    if(_client.isSSL) {
+        // tls needs the host name (SNI, certificate check)
+        useAddress = false;
+    }
+#endif
+
+    _stats.connectAttempts++;
+    unsigned long start = millis();
+#ifdef GET_FREE_HEAP
+    _stats.heapBeforeConnect = GET_FREE_HEAP;
+#endif
+
+#if !defined(ESP32)
+    // the connect of most network classes is limited by the stream timeout,
+    // only for the connect call, the handshake reads use the read timeout again
+    unsigned long streamTimeout = _client.tcp->getTimeout();
+    _client.tcp->setTimeout(_connectTimeout);
+#endif
+
+    if(useAddress) {
+        DEBUG_WEBSOCKETS("[WS-Client] connect to cached address of %s\n", _host.c_str());
+        _stats.addressCacheHits++;
+#if defined(ESP32)
+        ok = _client.tcp->connect(host->ip, _port, _connectTimeout);
+#else
+        ok = _client.tcp->connect(host->ip, _port);
+#endif
+    } else {
+#if defined(ESP32)
+        ok = _client.tcp->connect(_host.c_str(), _port, _connectTimeout);
+#else
+        ok = _client.tcp->connect(_host.c_str(), _port);
+#endif
+    }
+
+#if !defined(ESP32)
+    _client.tcp->setTimeout(streamTimeout);
+#endif
+
+    if(ok) {
+        _stats.connectTime = millis() - start;
+#if(WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP8266) || (WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP32) || (WEBSOCKETS_NETWORK_TYPE == NETWORK_RP2040)
+        if(!useAddress && _dnsCacheTTL && !_client.isSSL) {
+            host->ip      = _client.tcp->remoteIP();
+            host->ipValid = true;
+            host->ipTime  = millis();
+            host->ipTTL   = _dnsCacheTTL;
+        }
+#endif
+        connectedCb();
+        _lastConnectionFail = 0;
+    } else {
+        // address may be outdated, resolve the name on the next try
+        host->ipValid = false;
+        _stats.connectFailures++;
+        connectFailedCb();
+        _lastConnectionFail = millis();
+    }
+}
+
+/**
+ * time until loop() has work to do, can be used to sleep between loop() calls
+ * incoming data needs to wake the application up too
+ * @return ms, 0 = call loop() now, WEBSOCKETS_NO_TIMEOUT = no timer running
+ */
+uint32_t WebSocketsClient::nextTimeout(void) {
+    if(_port == 0) {
+        return WEBSOCKETS_NO_TIMEOUT;
+    }
+
+    unsigned long t = millis();
+
+    if(_connectPending) {
+        return 0;
+    }
+
+    // only look at the state, clientIsConnected() would clean up and fire events
+    if(!_client.tcp || _client.status == WSC_NOT_CONNECTED) {
+        // next reconnect
+        if((t - _lastConnectionFail) >= _reconnectDelay) {
+            return 0;
+        }
+        return _reconnectDelay - (t - _lastConnectionFail);
+    }
+
+    if(!_client.tcp->connected()) {
+        // connection lost, loop() does the cleanup
+        return 0;
+    }
+
+    if(_client.tcp->available() > 0) {
+        return 0;
+    }
+
+    if(_client.status == WSC_CONNECTED && _queueHead) {
+        // replay of the send queue
+        return 0;
+    }
+
+    if(_client.status == WSC_HEADER || _client.status == WSC_BODY) {
+        // header response timeout
+        if((t - _lastHeaderSent) > _client.limits.handshakeTimeout) {
+            return 0;
+        }
+        return _client.limits.handshakeTimeout - (t - _lastHeaderSent) + 1;
+    }
+
+    return nextHBTimeout(&_client);
+}
 #endif
 
 /**
@@ -339,25 +567,51 @@ void WebSocketsClient::loop(void) {
  * @param cbEvent WebSocketServerEvent
  */
 void WebSocketsClient::onEvent(WebSocketClientEvent cbEvent) {
-    _cbEvent = cbEvent;
+    _cbEvent    = cbEvent;
+    _cbEventArg = NULL;
+}
+
+/**
+ * set callback function with a user pointer
+ * called directly, no std::function in between
+ * @param cbEvent WebSocketClientEventArg
+ * @param arg void *  passed as first argument to cbEvent
+ */
+void WebSocketsClient::onEvent(WebSocketClientEventArg cbEvent, void * arg) {
+    _cbEvent       = NULL;
+    _cbEventArg    = cbEvent;
+    _cbEventArgPtr = arg;
+}
+
+/**
+ * set the buffer provider for received payloads
+ * the provider gets the needed size (payload length + 1)
+ * and returns a buffer of the app or NULL to use malloc
+ * the buffer is used until the event callback returns and is never freed by the library
+ * @param cbBuffer WebSocketClientBufferProvider
+ */
+void WebSocketsClient::onBuffer(WebSocketClientBufferProvider cbBuffer) {
+    _cbBuffer = cbBuffer;
 }
 
 /**
  * send text data to client
+ * while the send queue has entries the message is appended to the queue to keep the order,
+ * even if connected, loop() sends it after the queued ones
  * @param num uint8_t client id
  * @param payload uint8_t *
  * @param length size_t
  * @param headerToPayload bool  (see sendFrame for more details)
- * @return true if ok
+ * @return true if sent / queued, false if neither (queue disabled / full, no memory)
  */
 bool WebSocketsClient::sendTXT(uint8_t * payload, size_t length, bool headerToPayload) {
     if(length == 0) {
         length = strlen((const char *)payload);
     }
-    if(clientIsConnected(&_client)) {
+    if(!_queueHead && clientIsConnected(&_client) && _client.status == WSC_CONNECTED) {
         return sendFrame(&_client, WSop_text, payload, length, true, headerToPayload);
     }
-    return false;
+    return queueMessage(WSop_text, payload, length, headerToPayload);
 }
 
 bool WebSocketsClient::sendTXT(const uint8_t * payload, size_t length) {
@@ -382,25 +636,117 @@ bool WebSocketsClient::sendTXT(char payload) {
     return sendTXT(buf, 1, true);
 }
 
+/**
+ * send text data to server, takes the String
+ * while not connected the String is moved into the send queue (no copy)
+ * @param payload String &&
+ * @return true if ok / queued
+ */
+bool WebSocketsClient::sendTXT(String && payload) {
+    if(!_queueHead && clientIsConnected(&_client) && _client.status == WSC_CONNECTED) {
+        return sendFrame(&_client, WSop_text, (uint8_t *)payload.c_str(), payload.length());
+    }
+    if(_queueMaxMessages == 0) {
+        return false;
+    }
+
+    String * str = memNew<String>(std::move(payload));
+    if(!str) {
+        return false;
+    }
+    if(!queueOwned(WSop_text, (uint8_t *)str->c_str(), str->length(), NULL, str)) {
+        memDelete(str);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * send text data to server, takes the ownership of payload
+ * @param payload uint8_t *
+ * @param length size_t
+ * @param deleter WSpayloadDeleter  called when payload is send or dropped (releasePayload for detached payloads)
+ * @return true if ok / queued
+ */
+bool WebSocketsClient::sendTXTOwned(uint8_t * payload, size_t length, WSpayloadDeleter deleter) {
+    return sendOwned(WSop_text, payload, length, deleter);
+}
+
 /**
  * send binary data to client
+ * while the send queue has entries the message is appended to the queue to keep the order,
+ * even if connected, loop() sends it after the queued ones
  * @param num uint8_t client id
  * @param payload uint8_t *
  * @param length size_t
  * @param headerToPayload bool  (see sendFrame for more details)
- * @return true if ok
+ * @return true if sent / queued, false if neither (queue disabled / full, no memory)
  */
 bool WebSocketsClient::sendBIN(uint8_t * payload, size_t length, bool headerToPayload) {
-    if(clientIsConnected(&_client)) {
+    if(!_queueHead && clientIsConnected(&_client) && _client.status == WSC_CONNECTED) {
         return sendFrame(&_client, WSop_binary, payload, length, true, headerToPayload);
     }
-    return false;
+    return queueMessage(WSop_binary, payload, length, headerToPayload);
 }
 
 bool WebSocketsClient::sendBIN(const uint8_t * payload, size_t length) {
     return sendBIN((uint8_t *)payload, length);
 }
 
+/**
+ * send binary data to server, takes the ownership of payload
+ * @param payload uint8_t *
+ * @param length size_t
+ * @param deleter WSpayloadDeleter  called when payload is send or dropped (releasePayload for detached payloads)
+ * @return true if ok / queued
+ */
+bool WebSocketsClient::sendBINOwned(uint8_t * payload, size_t length, WSpayloadDeleter deleter) {
+    return sendOwned(WSop_binary, payload, length, deleter);
+}
+
+/**
+ * send data read from a stream (file, flash, ...) without a buffer for the whole payload
+ * the stream is not queued, the connection has to be up
+ * @param stream Stream &
+ * @param length size_t  payload length, WEBSOCKETS_STREAM_UNTIL_END to send until stream.available() is 0
+ * @param text bool  send as text message
+ * @return true if ok
+ */
+bool WebSocketsClient::sendStream(Stream & stream, size_t length, bool text) {
+    if(_queueHead) {
+        // keep the order of the queued messages
+        DEBUG_WEBSOCKETS("[WS-Client] sendStream: send queue not empty\n");
+        return false;
+    }
+    return WebSockets::sendStream(&_client, (text ? WSop_text : WSop_binary), stream, length);
+}
+
+/**
+ * sends or queues a payload of the application
+ * the payload is released in any case
+ * @param opcode WSopcode_t
+ * @param payload uint8_t *
+ * @param length size_t
+ * @param deleter WSpayloadDeleter
+ * @return true if ok / queued
+ */
+bool WebSocketsClient::sendOwned(WSopcode_t opcode, uint8_t * payload, size_t length, WSpayloadDeleter deleter) {
+    bool ret;
+    if(!_queueHead && clientIsConnected(&_client) && _client.status == WSC_CONNECTED) {
+        ret = sendFrame(&_client, opcode, payload, length);
+    } else {
+        ret = queueOwned(opcode, payload, length, deleter, NULL);
+        if(ret) {
+            // released by the queue
+            return true;
+        }
+    }
+    if(payload && deleter) {
+        deleter(payload);
+    }
+    return ret;
+}
+
 /**
  * sends a WS ping to Server
  * @param payload uint8_t *
@@ -431,6 +777,236 @@ void WebSocketsClient::disconnect(void) {
     }
 }
 
+/**
+ * takes the payload of a WStype_TEXT / WStype_BIN / WStype_FRAGMENT* event
+ * only valid inside the event callback, the buffer is not freed by the library any more
+ * the payload has length + 1 byte (text is 0 terminated)
+ * @return payload or NULL (no payload or already detached)
+ */
+uint8_t * WebSocketsClient::detachPayload(void) {
+    return WebSockets::detachPayload(&_client);
+}
+
+/**
+ * frees a payload taken with detachPayload
+ * @param payload uint8_t *
+ */
+void WebSocketsClient::releasePayload(uint8_t * payload) {
+    memFree(payload);
+}
+
+/**
+ * enables the send queue, sendTXT / sendBIN store the messages while not connected
+ * and they are send in order after the next WStype_CONNECTED event
+ * @param maxMessages size_t        max messages in the queue, 0 = disable the queue
+ * @param maxBytes size_t           max payload bytes in the queue, 0 = no limit
+ * @param maxAge uint32_t           ms a message is kept, 0 = no limit
+ * @param drop WSqueueDrop_t        which message is dropped if the queue is full
+ */
+void WebSocketsClient::setSendQueue(size_t maxMessages, size_t maxBytes, uint32_t maxAge, WSqueueDrop_t drop) {
+    _queueMaxMessages = maxMessages;
+    _queueMaxBytes    = maxBytes;
+    _queueMaxAge      = maxAge;
+    _queueDrop        = drop;
+
+    if(maxMessages == 0) {
+        clearSendQueue();
+    }
+}
+
+/**
+ * @return messages waiting in the send queue
+ */
+size_t WebSocketsClient::queuedMessages(void) {
+    return _queueCount;
+}
+
+/**
+ * drops all messages of the send queue
+ */
+void WebSocketsClient::clearSendQueue(void) {
+    while(_queueHead) {
+        dequeueMessage();
+    }
+}
+
+/**
+ * copy a message to the send queue
+ * @param opcode WSopcode_t
+ * @param payload uint8_t *
+ * @param length size_t
+ * @param headerToPayload bool  (see sendFrame for more details)
+ * @return true if the message is queued
+ */
+bool WebSocketsClient::queueMessage(WSopcode_t opcode, uint8_t * payload, size_t length, bool headerToPayload) {
+    // reserve the header space to send the message without a copy (headerToPayload)
+    // and the 0 terminator like the other payload buffers
+    WSqueueMsg_t * msg = queueAlloc(length, WEBSOCKETS_MAX_HEADER_SIZE + length + 1);
+    if(!msg) {
+        return false;
+    }
+
+    msg->payload = NULL;
+    msg->deleter = NULL;
+    msg->str     = NULL;
+    if(length) {
+        memcpy(WS_QUEUE_MSG_DATA(msg) + WEBSOCKETS_MAX_HEADER_SIZE, payload + (headerToPayload ? WEBSOCKETS_MAX_HEADER_SIZE : 0), length);
+    }
+    WS_QUEUE_MSG_DATA(msg)[WEBSOCKETS_MAX_HEADER_SIZE + length] = 0;
+
+    queueAppend(msg, opcode, length);
+    return true;
+}
+
+/**
+ * puts a message of the application in the send queue (no copy)
+ * on failure the caller still owns the payload
+ * @param opcode WSopcode_t
+ * @param payload uint8_t *
+ * @param length size_t
+ * @param deleter WSpayloadDeleter  frees payload after the send, NULL = not freed
+ * @param str String *               String holding the payload, deleted after the send
+ * @return true if the message is queued
+ */
+bool WebSocketsClient::queueOwned(WSopcode_t opcode, uint8_t * payload, size_t length, WSpayloadDeleter deleter, String * str) {
+    WSqueueMsg_t * msg = queueAlloc(length, 0);
+    if(!msg) {
+        return false;
+    }
+
+    msg->payload = payload;
+    msg->deleter = deleter;
+    msg->str     = str;
+
+    queueAppend(msg, opcode, length);
+    return true;
+}
+
+/**
+ * makes room in the send queue (drop policy) and allocates a entry
+ * @param length size_t     payload length counted for the limits
+ * @param extra size_t      bytes to allocate behind the entry
+ * @return entry or NULL
+ */
+WSqueueMsg_t * WebSocketsClient::queueAlloc(size_t length, size_t extra) {
+    if(_queueMaxMessages == 0) {
+        return NULL;
+    }
+
+    expireQueue();
+
+    if(_queueMaxBytes && length > _queueMaxBytes) {
+        DEBUG_WEBSOCKETS("[WS-Client][queueMessage] message to big for the queue (%u)\n", length);
+        _stats.queueDropped++;
+        return NULL;
+    }
+
+    while(_queueCount >= _queueMaxMessages || (_queueMaxBytes && (_queueBytes + length) > _queueMaxBytes)) {
+        if(_queueDrop == WSqueueDrop_newest) {
+            DEBUG_WEBSOCKETS("[WS-Client][queueMessage] queue full, message dropped\n");
+            _stats.queueDropped++;
+            return NULL;
+        }
+        DEBUG_WEBSOCKETS("[WS-Client][queueMessage] queue full, oldest message dropped\n");
+        _stats.queueDropped++;
+        dequeueMessage();
+    }
+
+    WSqueueMsg_t * msg = (WSqueueMsg_t *)memAlloc(sizeof(WSqueueMsg_t) + extra);
+    if(!msg) {
+        DEBUG_WEBSOCKETS("[WS-Client][queueMessage] no memory for the message (%u)\n", length);
+        _stats.queueDropped++;
+        return NULL;
+    }
+    return msg;
+}
+
+/**
+ * adds a entry of queueAlloc to the end of the send queue
+ * @param msg WSqueueMsg_t *
+ * @param opcode WSopcode_t
+ * @param length size_t
+ */
+void WebSocketsClient::queueAppend(WSqueueMsg_t * msg, WSopcode_t opcode, size_t length) {
+    msg->next   = NULL;
+    msg->time   = millis();
+    msg->opcode = opcode;
+    msg->length = length;
+
+    if(_queueTail) {
+        _queueTail->next = msg;
+    } else {
+        _queueHead = msg;
+    }
+    _queueTail = msg;
+    _queueCount++;
+    _queueBytes += length;
+    _stats.queued++;
+}
+
+/**
+ * removes the oldest message of the send queue
+ */
+void WebSocketsClient::dequeueMessage(void) {
+    WSqueueMsg_t * msg = _queueHead;
+    if(!msg) {
+        return;
+    }
+
+    _queueHead = msg->next;
+    if(!_queueHead) {
+        _queueTail = NULL;
+    }
+    _queueCount--;
+    _queueBytes -= msg->length;
+
+    if(msg->str) {
+        memDelete(msg->str);
+    } else if(msg->payload && msg->deleter) {
+        msg->deleter(msg->payload);
+    }
+    memFree(msg);
+}
+
+/**
+ * drops the messages older then _queueMaxAge
+ */
+void WebSocketsClient::expireQueue(void) {
+    if(_queueMaxAge == 0) {
+        return;
+    }
+    while(_queueHead && (millis() - _queueHead->time) > _queueMaxAge) {
+        DEBUG_WEBSOCKETS("[WS-Client][expireQueue] message expired\n");
+        _stats.queueDropped++;
+        dequeueMessage();
+    }
+}
+
+/**
+ * sends queued messages
+ * @param maxMessages size_t  max messages to send in this call
+ */
+void WebSocketsClient::handleSendQueue(size_t maxMessages) {
+    expireQueue();
+
+    while(_queueHead && maxMessages-- > 0) {
+        WSqueueMsg_t * msg = _queueHead;
+        bool ok;
+        if(msg->payload) {
+            // payload of the application (no header space), masked while sending, so it stays unchanged for a retry
+            ok = sendFrame(&_client, msg->opcode, msg->payload, msg->length, true, false);
+        } else {
+            ok = sendFrame(&_client, msg->opcode, WS_QUEUE_MSG_DATA(msg), msg->length, true, true);
+        }
+        if(!ok) {
+            // keep the message for the next connection
+            return;
+        }
+        _stats.queueSent++;
+        dequeueMessage();
+    }
+}
+
 /**
  * set the Authorizatio for the http request
  * @param user const char *
@@ -441,7 +1017,7 @@ void WebSocketsClient::setAuthorization(const char * user, const char * password
         String auth = user;
         auth += ":";
         auth += password;
-        _client.base64Authorization = base64_encode((uint8_t *)auth.c_str(), auth.length());
+        _base64Authorization = base64_encode((uint8_t *)auth.c_str(), auth.length());
     }
 }
 
@@ -451,8 +1027,8 @@ void WebSocketsClient::setAuthorization(const char * user, const char * password
  */
 void WebSocketsClient::setAuthorization(const char * auth) {
     if(auth) {
-        //_client.base64Authorization = auth;
-        _client.plainAuthorization = auth;
+        //_base64Authorization = auth;
+        _plainAuthorization = auth;
     }
 }
 
@@ -462,7 +1038,7 @@ void WebSocketsClient::setAuthorization(const char * auth) {
  * @param extraHeaders const char * extraHeaders
  */
 void WebSocketsClient::setExtraHeaders(const char * extraHeaders) {
-    _client.extraHeaders = extraHeaders;
+    _extraHeaders = extraHeaders;
 }
 
 /**
@@ -472,6 +1048,158 @@ void WebSocketsClient::setExtraHeaders(const char * extraHeaders) {
  */
 void WebSocketsClient::setReconnectInterval(unsigned long time) {
     _reconnectInterval = time;
+    _reconnectDelay    = time;
+}
+
+/**
+ * enable exponential backoff for reconnects
+ * the wait time doubles with every failed (or unstable) connection up to maxInterval,
+ * the actual time is randomized between minInterval and that cap to spread the reconnects of many devices
+ * @param minInterval unsigned long ms
+ * @param maxInterval unsigned long ms, 0 = disable backoff
+ * @param stableTime unsigned long ms a connection needs to last to reset the backoff
+ */
+void WebSocketsClient::setReconnectBackoff(unsigned long minInterval, unsigned long maxInterval, unsigned long stableTime) {
+    _reconnectInterval    = minInterval;
+    _reconnectIntervalMax = maxInterval;
+    _reconnectStableTime  = stableTime;
+    _reconnectDelay       = nextReconnectDelay(_reconnectFailures);
+}
+
+/**
+ * add a fallback host, used when the current one failed setFailoverThreshold times in a row
+ * needs to be called after begin
+ * @param host const char *
+ * @param port uint16_t
+ * @return true if ok
+ */
+bool WebSocketsClient::addHost(const char * host, uint16_t port) {
+    if(_hostCount == 0 || _hostCount >= WEBSOCKETS_CLIENT_HOST_MAX) {
+        return false;
+    }
+    resetHost(&_hosts[_hostCount], host, port);
+    _hostCount++;
+    return true;
+}
+
+bool WebSocketsClient::addHost(String host, uint16_t port) {
+    return addHost(host.c_str(), port);
+}
+
+/**
+ * set after how many failed connections in a row the next host is used
+ * @param failures uint8_t
+ */
+void WebSocketsClient::setFailoverThreshold(uint8_t failures) {
+    _failoverThreshold = failures;
+}
+
+/**
+ * set a pre-resolved address for a host, the connect skips the name resolution
+ * (not used for wss since tls needs the host name)
+ * @param index uint8_t 0 = host of begin, 1.. hosts of addHost in order
+ * @param ip IPAddress
+ * @param ttl uint32_t ms the address is valid, 0 = no expiry
+ * @return true if ok
+ */
+bool WebSocketsClient::setHostAddress(uint8_t index, IPAddress ip, uint32_t ttl) {
+    if(index >= _hostCount) {
+        return false;
+    }
+    WSclientHost_t * host = &_hosts[index];
+    host->ip              = ip;
+    host->ipValid         = true;
+    host->ipTime          = millis();
+    host->ipTTL           = ttl;
+    return true;
+}
+
+/**
+ * set how long the address of a successful connection is reused for reconnects
+ * @param ttl uint32_t ms, 0 = always resolve the host name
+ */
+void WebSocketsClient::setDnsCacheTTL(uint32_t ttl) {
+    _dnsCacheTTL = ttl;
+}
+
+/**
+ * set the timeouts of the connection phases
+ * the Arduino network classes have no non-blocking connect,
+ * the loop() call doing the connect blocks for up to connectTimeout
+ * @param connectTimeout uint32_t ms for the tcp connect (incl. dns and tls)
+ * @param handshakeTimeout uint32_t ms for the http upgrade response
+ */
+void WebSocketsClient::setConnectTimeout(uint32_t connectTimeout, uint32_t handshakeTimeout) {
+    _connectTimeout                 = connectTimeout;
+    _limits.handshakeTimeout        = handshakeTimeout;
+    _client.limits.handshakeTimeout = handshakeTimeout;
+}
+
+/**
+ * set the limits of the running connection and the next ones
+ * (can be called in the WStype_CONNECTED event)
+ * @param limits const WSlimits_t &
+ */
+void WebSocketsClient::setLimits(const WSlimits_t & limits) {
+    _limits        = limits;
+    _client.limits = limits;
+}
+
+/**
+ * limits of the connection
+ * @return WSlimits_t
+ */
+WSlimits_t WebSocketsClient::getLimits(void) {
+    return _limits;
+}
+
+/**
+ * deliver fragmented messages in one piece (WStype_TEXT / WStype_BIN) instead of WStype_FRAGMENT_* events
+ * the message size is bounded by the maxMessageSize limit (maxFrameSize if not set)
+ * used from the next connection on
+ * @param enable bool
+ */
+void WebSocketsClient::setReassembly(bool enable) {
+    _reassemble = enable;
+}
+
+/**
+ * writer to build a text message in place (no copy, see WebSocketsFrameWriter)
+ * @return WebSocketsFrameWriter, send it with send()
+ */
+WebSocketsFrameWriter WebSocketsClient::frameTXT(void) {
+    return WebSocketsFrameWriter(sendFrameWriter, this, 0, WSop_text);
+}
+
+/**
+ * writer to build a binary message in place (no copy, see WebSocketsFrameWriter)
+ * @return WebSocketsFrameWriter, send it with send()
+ */
+WebSocketsFrameWriter WebSocketsClient::frameBIN(void) {
+    return WebSocketsFrameWriter(sendFrameWriter, this, 0, WSop_binary);
+}
+
+/**
+ * send function of the frame writers, queues like sendTXT / sendBIN
+ * @param client void *  WebSocketsClient
+ * @param payload uint8_t *  with WEBSOCKETS_MAX_HEADER_SIZE header room
+ * @param length size_t  payload length (0 = empty message)
+ */
+bool WebSocketsClient::sendFrameWriter(void * client, uint8_t num, WSopcode_t opcode, uint8_t * payload, size_t length) {
+    WebSocketsClient * c = (WebSocketsClient *)client;
+    UNUSED(num);
+    if(!c->_queueHead && c->clientIsConnected(&c->_client) && c->_client.status == WSC_CONNECTED) {
+        return c->sendFrame(&c->_client, opcode, payload, length, true, true);
+    }
+    return c->queueMessage(opcode, payload, length, true);
+}
+
+/**
+ * connection statistics
+ * @return WSclientStats_t
+ */
+WSclientStats_t WebSocketsClient::getStats(void) {
+    return _stats;
 }
 
 bool WebSocketsClient::isConnected(void) {
@@ -525,6 +1253,13 @@ void WebSocketsClient::messageReceived(WSclient_t * client, WSopcode_t opcode, u
 void WebSocketsClient::clientDisconnect(WSclient_t * client) {
     bool event = false;
 
+    if(client->status == WSC_CONNECTED || client->status == WSC_CLOSING) {
+        // start of the reconnect, see WSclientStats_t::reconnectTime
+        _disconnectTime = millis();
+    }
+
+    handleReconnectPolicy(client);
+
 #if(WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP8266) || (WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP32) || (WEBSOCKETS_NETWORK_TYPE == NETWORK_RP2040)
     if(client->isSSL && client->ssl) {
         if(client->ssl->connected()) {
@@ -532,7 +1267,8 @@ void WebSocketsClient::clientDisconnect(WSclient_t * client) {
             client->ssl->stop();
         }
         event = true;
-        delete client->ssl;
+        // keep the network class for the next connection
+        _sslIdle    = client->ssl;
         client->ssl = NULL;
         client->tcp = NULL;
     }
@@ -549,25 +1285,28 @@ void WebSocketsClient::clientDisconnect(WSclient_t * client) {
 #if(WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP8266_ASYNC)
         client->status = WSC_NOT_CONNECTED;
 #else
-#if(WEBSOCKETS_NETWORK_TYPE == NETWORK_WIFI_NINA) || (WEBSOCKETS_NETWORK_TYPE == NETWORK_SAMD_SEED) || (WEBSOCKETS_NETWORK_TYPE == NETWORK_UNOWIFIR4)
-        // does not support delete (no destructor)
-#else
-        delete client->tcp;
+        // keep the network class for the next connection
+#if defined(HAS_SSL)
+        if(client->isSSL && client->ssl) {
+            _sslIdle    = client->ssl;
+            client->ssl = NULL;
+        } else
 #endif
+        {
+            _tcpIdle = client->tcp;
+        }
 #endif
         client->tcp = NULL;
     }
 
-    client->cCode        = 0;
-    client->cKey         = "";
-    client->cAccept      = "";
-    client->cVersion     = 0;
-    client->cIsUpgrade   = false;
-    client->cIsWebsocket = false;
-    client->cSessionId   = "";
+    freeHandshake();
+    freeRxBuffer(client);
+    freeMessageBuffer(client);
+    client->cMaskState = 0;
 
     client->status      = WSC_NOT_CONNECTED;
     _lastConnectionFail = millis();
+    _connectPending     = false;
 
     DEBUG_WEBSOCKETS("[WS-Client] client disconnected.\n");
     if(event) {
@@ -610,25 +1349,31 @@ bool WebSocketsClient::clientIsConnected(WSclient_t * client) {
  * Handel incomming data from Client
  */
 void WebSocketsClient::handleClientData(void) {
-    if((_client.status == WSC_HEADER || _client.status == WSC_BODY) && _lastHeaderSent + WEBSOCKETS_TCP_TIMEOUT < millis()) {
+    if((_client.status == WSC_HEADER || _client.status == WSC_BODY) && (millis() - _lastHeaderSent) > _client.limits.handshakeTimeout) {
         DEBUG_WEBSOCKETS("[WS-Client][handleClientData] header response timeout.. disconnecting!\n");
         clientDisconnect(&_client);
-        WEBSOCKETS_YIELD();
+        yieldLoop();
         return;
     }
 
-    int len = _client.tcp->available();
-    if(len > 0) {
+    // handle everything already buffered (bounded to not starve the application)
+    for(uint8_t n = 0; n < WEBSOCKETS_MAX_FRAMES_PER_LOOP; n++) {
+        int len = _client.tcp->available();
+        if(len <= 0) {
+            break;
+        }
         switch(_client.status) {
             case WSC_HEADER: {
-                String headerLine = _client.tcp->readStringUntil('\n');
-                handleHeader(&_client, &headerLine);
+                size_t lineLen    = 0;
+                char * headerLine = handshakeReadLine(&_client, &lineLen);
+                handleHeaderLine(&_client, headerLine, lineLen);
             } break;
             case WSC_BODY: {
-                char buf[256] = { 0 };
-                _client.tcp->readBytes(&buf[0], std::min((size_t)len, sizeof(buf)));
-                String bodyLine = buf;
-                handleHeader(&_client, &bodyLine);
+                char buf[256]  = { 0 };
+                size_t bodyLen = _client.tcp->readBytes(&buf[0], std::min((size_t)len, sizeof(buf) - 1));
+                buf[bodyLen]   = 0;
+                char * body    = trimLine(&buf[0], &bodyLen);
+                handleHeaderLine(&_client, body, bodyLen);
             } break;
             case WSC_CONNECTED:
                 WebSockets::handleWebsocket(&_client);
@@ -637,8 +1382,11 @@ void WebSocketsClient::handleClientData(void) {
                 WebSockets::clientDisconnect(&_client, 1002);
                 break;
         }
+        if(!clientIsConnected(&_client)) {
+            break;
+        }
     }
-    WEBSOCKETS_YIELD();
+    yieldLoop();
 }
 #endif
 
@@ -647,8 +1395,6 @@ void WebSocketsClient::handleClientData(void) {
  * @param client WSclient_t *  ptr to the client struct
  */
 void WebSocketsClient::sendHeader(WSclient_t * client) {
-    static const char * NEW_LINE = "\r\n";
-
     DEBUG_WEBSOCKETS("[WS-Client][sendHeader] sending header...\n");
 
     uint8_t randomKey[16] = { 0 };
@@ -657,150 +1403,207 @@ void WebSocketsClient::sendHeader(WSclient_t * client) {
         randomKey[i] = random(0xFF);
     }
 
-    client->cKey = base64_encode(&randomKey[0], 16);
+    client->handshake->cKey = handshakeAlloc(client, WEBSOCKETS_BASE64_SIZE(16));
+    if(client->handshake->cKey) {
+        base64_encode(&randomKey[0], 16, client->handshake->cKey);
+    }
 
 #ifndef NODEBUG_WEBSOCKETS
     unsigned long start = micros();
 #endif
 
-    String handshake;
+    // measure first, the request is build in the arena (malloc only if it does not fit)
+    size_t len       = buildHeader(client, NULL);
+    char * handshake = handshakeAlloc(client, len + 1, true);
+    if(handshake) {
+        buildHeader(client, handshake);
+        handshake[len] = 0;
+
+        DEBUG_WEBSOCKETS("[WS-Client][sendHeader] handshake %s", handshake);
+        write(client, (uint8_t *)handshake, len);
+        handshakeRelease(client, handshake);
+    }
+
+#if(WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP8266_ASYNC)
+    client->tcp->readStringUntil('\n', &(client->cHttpLine), std::bind(&WebSocketsClient::handleHeader, this, client, &(client->cHttpLine)));
+#endif
+
+    DEBUG_WEBSOCKETS("[WS-Client][sendHeader] sending header... Done (%luus).\n", (micros() - start));
+    _lastHeaderSent = millis();
+}
+
+/**
+ * build the http request for the WebSocket upgrade
+ * @param client WSclient_t *  ptr to the client struct
+ * @param out char *   NULL to only get the length
+ * @return length of the request
+ */
+size_t WebSocketsClient::buildHeader(WSclient_t * client, char * out) {
+    static const char * NEW_LINE = "\r\n";
+
     bool ws_header = true;
-    String url     = client->cUrl;
+
+    size_t len = handshakeAppend(out, 0, WEBSOCKETS_STRING("GET "));
+    len        = handshakeAppend(out, len, _url);
 
     if(client->isSocketIO) {
-        if(client->cSessionId.length() == 0) {
-            url += WEBSOCKETS_STRING("&transport=polling");
+        if(client->handshake->cSessionId.length() == 0) {
+            len       = handshakeAppend(out, len, WEBSOCKETS_STRING("&transport=polling"));
             ws_header = false;
         } else {
-            url += WEBSOCKETS_STRING("&transport=websocket&sid=");
-            url += client->cSessionId;
+            len = handshakeAppend(out, len, WEBSOCKETS_STRING("&transport=websocket&sid="));
+            len = handshakeAppend(out, len, client->handshake->cSessionId);
         }
     }
 
-    handshake = WEBSOCKETS_STRING("GET ");
-    handshake += url + WEBSOCKETS_STRING(
-                           " HTTP/1.1\r\n"
-                           "Host: ");
-    handshake += _host + ":" + _port + NEW_LINE;
+    char port[7];
+    snprintf(port, sizeof(port), ":%u", _port);
+
+    len = handshakeAppend(out, len, WEBSOCKETS_STRING(" HTTP/1.1\r\n"
+                                                      "Host: "));
+    len = handshakeAppend(out, len, _host);
+    len = handshakeAppend(out, len, port);
+    len = handshakeAppend(out, len, NEW_LINE);
 
     if(ws_header) {
-        handshake += WEBSOCKETS_STRING(
-            "Connection: Upgrade\r\n"
-            "Upgrade: websocket\r\n"
-            "Sec-WebSocket-Version: 13\r\n"
-            "Sec-WebSocket-Key: ");
-        handshake += client->cKey + NEW_LINE;
-
-        if(client->cProtocol.length() > 0) {
-            handshake += WEBSOCKETS_STRING("Sec-WebSocket-Protocol: ");
-            handshake += client->cProtocol + NEW_LINE;
+        len = handshakeAppend(out, len, WEBSOCKETS_STRING("Connection: Upgrade\r\n"
+                                                          "Upgrade: websocket\r\n"
+                                                          "Sec-WebSocket-Version: 13\r\n"
+                                                          "Sec-WebSocket-Key: "));
+        if(client->handshake->cKey) {
+            len = handshakeAppend(out, len, client->handshake->cKey);
+        }
+        len = handshakeAppend(out, len, NEW_LINE);
+
+        if(_protocol.length() > 0) {
+            len = handshakeAppend(out, len, WEBSOCKETS_STRING("Sec-WebSocket-Protocol: "));
+            len = handshakeAppend(out, len, _protocol);
+            len = handshakeAppend(out, len, NEW_LINE);
         }
 
-        if(client->cExtensions.length() > 0) {
-            handshake += WEBSOCKETS_STRING("Sec-WebSocket-Extensions: ");
-            handshake += client->cExtensions + NEW_LINE;
+        if(client->handshake->cExtensions.length() > 0) {
+            len = handshakeAppend(out, len, WEBSOCKETS_STRING("Sec-WebSocket-Extensions: "));
+            len = handshakeAppend(out, len, client->handshake->cExtensions);
+            len = handshakeAppend(out, len, NEW_LINE);
         }
     } else {
-        handshake += WEBSOCKETS_STRING("Connection: keep-alive\r\n");
+        len = handshakeAppend(out, len, WEBSOCKETS_STRING("Connection: keep-alive\r\n"));
     }
 
     // add extra headers; by default this includes "Origin: file://"
-    if(client->extraHeaders.length() > 0) {
-        handshake += client->extraHeaders + NEW_LINE;
+    if(_extraHeaders.length() > 0) {
+        len = handshakeAppend(out, len, _extraHeaders);
+        len = handshakeAppend(out, len, NEW_LINE);
     }
 
-    handshake += WEBSOCKETS_STRING("User-Agent: arduino-WebSocket-Client\r\n");
+    len = handshakeAppend(out, len, WEBSOCKETS_STRING("User-Agent: arduino-WebSocket-Client\r\n"));
 
-    if(client->base64Authorization.length() > 0) {
-        handshake += WEBSOCKETS_STRING("Authorization: Basic ");
-        handshake += client->base64Authorization + NEW_LINE;
+    if(_base64Authorization.length() > 0) {
+        len = handshakeAppend(out, len, WEBSOCKETS_STRING("Authorization: Basic "));
+        len = handshakeAppend(out, len, _base64Authorization);
+        len = handshakeAppend(out, len, NEW_LINE);
     }
 
-    if(client->plainAuthorization.length() > 0) {
-        handshake += WEBSOCKETS_STRING("Authorization: ");
-        handshake += client->plainAuthorization + NEW_LINE;
+    if(_plainAuthorization.length() > 0) {
+        len = handshakeAppend(out, len, WEBSOCKETS_STRING("Authorization: "));
+        len = handshakeAppend(out, len, _plainAuthorization);
+        len = handshakeAppend(out, len, NEW_LINE);
     }
 
-    handshake += NEW_LINE;
-
-    DEBUG_WEBSOCKETS("[WS-Client][sendHeader] handshake %s", (uint8_t *)handshake.c_str());
-    write(client, (uint8_t *)handshake.c_str(), handshake.length());
-
-#if(WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP8266_ASYNC)
-    client->tcp->readStringUntil('\n', &(client->cHttpLine), std::bind(&WebSocketsClient::handleHeader, this, client, &(client->cHttpLine)));
-#endif
-
-    DEBUG_WEBSOCKETS("[WS-Client][sendHeader] sending header... Done (%luus).\n", (micros() - start));
-    _lastHeaderSent = millis();
+    return handshakeAppend(out, len, NEW_LINE);
 }
 
 /**
  * handle the WebSocket header reading
  * @param client WSclient_t *  ptr to the client struct
+ * @param headerLine String *  header line
  */
 void WebSocketsClient::handleHeader(WSclient_t * client, String * headerLine) {
-    headerLine->trim();    // remove \r
+    size_t length = 0;
+    char * line   = handshakeLine(client, headerLine, &length);
+    handleHeaderLine(client, line, length);
+}
+
+/**
+ * handle the WebSocket header reading
+ * the line is parsed in place, everything kept is stored in the handshake arena
+ * @param client WSclient_t *  ptr to the client struct
+ * @param headerLine char *  trimmed header line
+ * @param length size_t  length of the header line
+ */
+void WebSocketsClient::handleHeaderLine(WSclient_t * client, char * headerLine, size_t length) {
+    if(!client->handshake || !headerLine) {
+        // header line longer than WEBSOCKETS_MAX_HEADER_LINE_SIZE or no memory for it
+        DEBUG_WEBSOCKETS("[WS-Client][handleHeader] header line too long, disconnecting\n");
+        clientDisconnect(client);
+        return;
+    }
 
     // this code handels the http body for Socket.IO V3 requests
-    if(headerLine->length() > 0 && client->isSocketIO && client->status == WSC_BODY && client->cSessionId.length() == 0) {
-        DEBUG_WEBSOCKETS("[WS-Client][handleHeader] socket.io json: %s\n", headerLine->c_str());
-        String sid_begin = WEBSOCKETS_STRING("\"sid\":\"");
-        if(headerLine->indexOf(sid_begin) > -1) {
-            int start          = headerLine->indexOf(sid_begin) + sid_begin.length();
-            int end            = headerLine->indexOf('"', start);
-            client->cSessionId = headerLine->substring(start, end);
-            DEBUG_WEBSOCKETS("[WS-Client][handleHeader]  - cSessionId: %s\n", client->cSessionId.c_str());
+    if(length > 0 && client->isSocketIO && client->status == WSC_BODY && client->handshake->cSessionId.length() == 0) {
+        DEBUG_WEBSOCKETS("[WS-Client][handleHeader] socket.io json: %s\n", headerLine);
+        char * sid = strstr(headerLine, "\"sid\":\"");
+        if(sid) {
+            sid += 7;
+            char * end = strchr(sid, '"');
+            if(end) {
+                *end = 0;
+            }
+            client->handshake->cSessionId = sid;
+            DEBUG_WEBSOCKETS("[WS-Client][handleHeader]  - cSessionId: %s\n", client->handshake->cSessionId.c_str());
 
             // Trigger websocket connection code path
-            *headerLine = "";
+            length = 0;
         }
     }
 
     // headle HTTP header
-    if(headerLine->length() > 0) {
-        DEBUG_WEBSOCKETS("[WS-Client][handleHeader] RX: %s\n", headerLine->c_str());
+    if(length > 0) {
+        DEBUG_WEBSOCKETS("[WS-Client][handleHeader] RX: %s\n", headerLine);
+
+        char * headerValue = strchr(headerLine, ':');
 
-        if(headerLine->startsWith(WEBSOCKETS_STRING("HTTP/1."))) {
+        if(strncmp(headerLine, "HTTP/1.", 7) == 0) {
             // "HTTP/1.1 101 Switching Protocols"
-            client->cCode = headerLine->substring(9, headerLine->indexOf(' ', 9)).toInt();
-        } else if(headerLine->indexOf(':') >= 0) {
-            String headerName  = headerLine->substring(0, headerLine->indexOf(':'));
-            String headerValue = headerLine->substring(headerLine->indexOf(':') + 1);
+            client->handshake->cCode = (length > 9) ? atoi(headerLine + 9) : 0;
+        } else if(headerValue) {
+            *headerValue++ = 0;
+            char * headerName = headerLine;
 
             // remove space in the beginning  (RFC2616)
-            if(headerValue[0] == ' ') {
-                headerValue.remove(0, 1);
+            while(*headerValue == ' ') {
+                headerValue++;
             }
 
-            if(headerName.equalsIgnoreCase(WEBSOCKETS_STRING("Connection"))) {
-                if(headerValue.equalsIgnoreCase(WEBSOCKETS_STRING("upgrade"))) {
-                    client->cIsUpgrade = true;
+            if(WEBSOCKETS_STRCASEEQ(headerName, "Connection")) {
+                if(WEBSOCKETS_STRCASEEQ(headerValue, "upgrade")) {
+                    client->handshake->cIsUpgrade = true;
                 }
-            } else if(headerName.equalsIgnoreCase(WEBSOCKETS_STRING("Upgrade"))) {
-                if(headerValue.equalsIgnoreCase(WEBSOCKETS_STRING("websocket"))) {
-                    client->cIsWebsocket = true;
+            } else if(WEBSOCKETS_STRCASEEQ(headerName, "Upgrade")) {
+                if(WEBSOCKETS_STRCASEEQ(headerValue, "websocket")) {
+                    client->handshake->cIsWebsocket = true;
                 }
-            } else if(headerName.equalsIgnoreCase(WEBSOCKETS_STRING("Sec-WebSocket-Accept"))) {
-                client->cAccept = headerValue;
-                client->cAccept.trim();    // see rfc6455
-            } else if(headerName.equalsIgnoreCase(WEBSOCKETS_STRING("Sec-WebSocket-Protocol"))) {
-                client->cProtocol = headerValue;
-            } else if(headerName.equalsIgnoreCase(WEBSOCKETS_STRING("Sec-WebSocket-Extensions"))) {
-                client->cExtensions = headerValue;
-            } else if(headerName.equalsIgnoreCase(WEBSOCKETS_STRING("Sec-WebSocket-Version"))) {
-                client->cVersion = headerValue.toInt();
-            } else if(headerName.equalsIgnoreCase(WEBSOCKETS_STRING("Set-Cookie")) && headerValue.indexOf(" io=") > -1) {
-                if(headerValue.indexOf(';') > -1) {
-                    client->cSessionId = headerValue.substring(headerValue.indexOf('=') + 1, headerValue.indexOf(";"));
-                } else {
-                    client->cSessionId = headerValue.substring(headerValue.indexOf('=') + 1);
+            } else if(WEBSOCKETS_STRCASEEQ(headerName, "Sec-WebSocket-Accept")) {
+                // the line is already trimmed, see rfc6455
+                client->handshake->cAccept = handshakeStore(client, headerValue, strlen(headerValue));
+            } else if(WEBSOCKETS_STRCASEEQ(headerName, "Sec-WebSocket-Protocol")) {
+                client->handshake->cProtocol = headerValue;
+            } else if(WEBSOCKETS_STRCASEEQ(headerName, "Sec-WebSocket-Extensions")) {
+                client->handshake->cExtensions = headerValue;
+            } else if(WEBSOCKETS_STRCASEEQ(headerName, "Sec-WebSocket-Version")) {
+                client->handshake->cVersion = atoi(headerValue);
+            } else if(WEBSOCKETS_STRCASEEQ(headerName, "Set-Cookie") && strstr(headerValue, " io=")) {
+                char * sid = strchr(headerValue, '=') + 1;
+                char * end = strchr(sid, ';');
+                if(end) {
+                    *end = 0;
                 }
+                client->handshake->cSessionId = sid;
             }
         } else {
-            DEBUG_WEBSOCKETS("[WS-Client][handleHeader] Header error (%s)\n", headerLine->c_str());
+            DEBUG_WEBSOCKETS("[WS-Client][handleHeader] Header error (%s)\n", headerLine);
         }
 
-        (*headerLine) = "";
 #if(WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP8266_ASYNC)
         client->tcp->readStringUntil('\n', &(client->cHttpLine), std::bind(&WebSocketsClient::handleHeader, this, client, &(client->cHttpLine)));
 #endif
@@ -808,20 +1611,20 @@ void WebSocketsClient::handleHeader(WSclient_t * client, String * headerLine) {
         DEBUG_WEBSOCKETS("[WS-Client][handleHeader] Header read fin.\n");
         DEBUG_WEBSOCKETS("[WS-Client][handleHeader] Client settings:\n");
 
-        DEBUG_WEBSOCKETS("[WS-Client][handleHeader]  - cURL: %s\n", client->cUrl.c_str());
-        DEBUG_WEBSOCKETS("[WS-Client][handleHeader]  - cKey: %s\n", client->cKey.c_str());
+        DEBUG_WEBSOCKETS("[WS-Client][handleHeader]  - cURL: %s\n", _url.c_str());
+        DEBUG_WEBSOCKETS("[WS-Client][handleHeader]  - cKey: %s\n", client->handshake->cKey ? client->handshake->cKey : "");
 
         DEBUG_WEBSOCKETS("[WS-Client][handleHeader] Server header:\n");
-        DEBUG_WEBSOCKETS("[WS-Client][handleHeader]  - cCode: %d\n", client->cCode);
-        DEBUG_WEBSOCKETS("[WS-Client][handleHeader]  - cIsUpgrade: %d\n", client->cIsUpgrade);
-        DEBUG_WEBSOCKETS("[WS-Client][handleHeader]  - cIsWebsocket: %d\n", client->cIsWebsocket);
-        DEBUG_WEBSOCKETS("[WS-Client][handleHeader]  - cAccept: %s\n", client->cAccept.c_str());
-        DEBUG_WEBSOCKETS("[WS-Client][handleHeader]  - cProtocol: %s\n", client->cProtocol.c_str());
-        DEBUG_WEBSOCKETS("[WS-Client][handleHeader]  - cExtensions: %s\n", client->cExtensions.c_str());
-        DEBUG_WEBSOCKETS("[WS-Client][handleHeader]  - cVersion: %d\n", client->cVersion);
-        DEBUG_WEBSOCKETS("[WS-Client][handleHeader]  - cSessionId: %s\n", client->cSessionId.c_str());
-
-        if(client->isSocketIO && client->cSessionId.length() == 0 && clientIsConnected(client)) {
+        DEBUG_WEBSOCKETS("[WS-Client][handleHeader]  - cCode: %d\n", client->handshake->cCode);
+        DEBUG_WEBSOCKETS("[WS-Client][handleHeader]  - cIsUpgrade: %d\n", client->handshake->cIsUpgrade);
+        DEBUG_WEBSOCKETS("[WS-Client][handleHeader]  - cIsWebsocket: %d\n", client->handshake->cIsWebsocket);
+        DEBUG_WEBSOCKETS("[WS-Client][handleHeader]  - cAccept: %s\n", client->handshake->cAccept ? client->handshake->cAccept : "");
+        DEBUG_WEBSOCKETS("[WS-Client][handleHeader]  - cProtocol: %s\n", client->handshake->cProtocol.c_str());
+        DEBUG_WEBSOCKETS("[WS-Client][handleHeader]  - cExtensions: %s\n", client->handshake->cExtensions.c_str());
+        DEBUG_WEBSOCKETS("[WS-Client][handleHeader]  - cVersion: %d\n", client->handshake->cVersion);
+        DEBUG_WEBSOCKETS("[WS-Client][handleHeader]  - cSessionId: %s\n", client->handshake->cSessionId.c_str());
+
+        if(client->isSocketIO && client->handshake->cSessionId.length() == 0 && clientIsConnected(client)) {
             DEBUG_WEBSOCKETS("[WS-Client][handleHeader] still missing cSessionId try socket.io V3\n");
             client->status = WSC_BODY;
             return;
@@ -829,10 +1632,10 @@ void WebSocketsClient::handleHeader(WSclient_t * client, String * headerLine) {
             client->status = WSC_HEADER;
         }
 
-        bool ok = (client->cIsUpgrade && client->cIsWebsocket);
+        bool ok = (client->handshake->cIsUpgrade && client->handshake->cIsWebsocket);
 
         if(ok) {
-            switch(client->cCode) {
+            switch(client->handshake->cCode) {
                 case 101:    ///< Switching Protocols
 
                     break;
@@ -846,7 +1649,7 @@ void WebSocketsClient::handleHeader(WSclient_t * client, String * headerLine) {
                              // falls through
                 default:     ///< Server dont unterstand requrst
                     ok = false;
-                    DEBUG_WEBSOCKETS("[WS-Client][handleHeader] serverCode is not 101 (%d)\n", client->cCode);
+                    DEBUG_WEBSOCKETS("[WS-Client][handleHeader] serverCode is not 101 (%d)\n", client->handshake->cCode);
                     clientDisconnect(client);
                     _lastConnectionFail = millis();
                     break;
@@ -854,12 +1657,12 @@ void WebSocketsClient::handleHeader(WSclient_t * client, String * headerLine) {
         }
 
         if(ok) {
-            if(client->cAccept.length() == 0) {
+            if(!client->handshake->cAccept || client->handshake->cAccept[0] == 0) {
                 ok = false;
             } else {
                 // generate Sec-WebSocket-Accept key for check
-                String sKey = acceptKey(client->cKey);
-                if(sKey != client->cAccept) {
+                char * sKey = acceptKey(client, client->handshake->cKey);
+                if(!sKey || strcmp(sKey, client->handshake->cAccept) != 0) {
                     DEBUG_WEBSOCKETS("[WS-Client][handleHeader] Sec-WebSocket-Accept is wrong\n");
                     ok = false;
                 }
@@ -870,10 +1673,26 @@ void WebSocketsClient::handleHeader(WSclient_t * client, String * headerLine) {
             DEBUG_WEBSOCKETS("[WS-Client][handleHeader] Websocket connection init done.\n");
             headerDone(client);
 
-            runCbEvent(WStype_CONNECTED, (uint8_t *)client->cUrl.c_str(), client->cUrl.length());
+            _stats.connects++;
+            _stats.handshakeTime = millis() - _lastHeaderSent;
+            _connectedSince      = millis();
+            if(_disconnectTime) {
+                _stats.reconnectTime = _connectedSince - _disconnectTime;
+            }
+#ifdef GET_FREE_HEAP
+            _stats.heapConnected = GET_FREE_HEAP;
+#endif
+
+            // the handshake data is not needed anymore
+            freeHandshake();
+            runCbEvent(WStype_CONNECTED, (uint8_t *)_url.c_str(), _url.length());
+#if(WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP8266_ASYNC)
+            // no loop() to replay the queue in batches
+            handleSendQueue(_queueCount);
+#endif
 #if(WEBSOCKETS_NETWORK_TYPE != NETWORK_ESP8266_ASYNC)
         } else if(client->isSocketIO) {
-            if(client->cSessionId.length() > 0) {
+            if(client->handshake && client->handshake->cSessionId.length() > 0) {
                 DEBUG_WEBSOCKETS("[WS-Client][handleHeader] found cSessionId\n");
                 if(clientIsConnected(client) && _client.tcp->available()) {
                     // read not needed data
@@ -913,11 +1732,19 @@ void WebSocketsClient::connectedCb() {
         this, std::placeholders::_1, &_client));
 #endif
 
-    _client.status = WSC_HEADER;
+    if(!initHandshake()) {
+        WebSockets::clientDisconnect(&_client, 1000);
+        return;
+    }
+
+    _client.status        = WSC_HEADER;
+    _client.limits        = _limits;
+    _client.cReassemble   = _reassemble;
+    _client.cRxMessageLen = 0;
 
 #if(WEBSOCKETS_NETWORK_TYPE != NETWORK_ESP8266_ASYNC)
     // set Timeout for readBytesUntil and readStringUntil
-    _client.tcp->setTimeout(WEBSOCKETS_TCP_TIMEOUT);
+    _client.tcp->setTimeout(_client.limits.readTimeout);
 #endif
 
 #if(WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP8266) || (WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP32) || (WEBSOCKETS_NETWORK_TYPE == NETWORK_RP2040)
@@ -994,6 +1821,95 @@ void WebSocketsClient::asyncConnect() {
 
 #endif
 
+/**
+ * count the failed connections and calculate the time until the next attempt
+ * switches to the healthiest host if the current one fails too often
+ * @param client WSclient_t *  ptr to the client struct
+ */
+void WebSocketsClient::handleReconnectPolicy(WSclient_t * client) {
+    if(!client->tcp) {
+        // nothing to disconnect
+        return;
+    }
+
+    WSclientHost_t * host = &_hosts[_hostIndex];
+
+    if(client->status == WSC_CONNECTED && (millis() - _connectedSince) >= _reconnectStableTime) {
+        _reconnectFailures = 0;
+        host->failures     = 0;
+    } else {
+        if(_reconnectFailures < 0xFF) {
+            _reconnectFailures++;
+        }
+        if(host->failures < 0xFF) {
+            host->failures++;
+        }
+    }
+
+    _reconnectDelay = nextReconnectDelay(_reconnectFailures);
+
+    if(_hostCount > 1 && _failoverThreshold && host->failures >= _failoverThreshold) {
+        // use the host with the fewest failures, on a tie the next one in the list
+        uint8_t best = _hostIndex;
+        for(uint8_t i = 1; i < _hostCount; i++) {
+            uint8_t n = (_hostIndex + i) % _hostCount;
+            if(_hosts[n].failures < _hosts[best].failures) {
+                best = n;
+            } else if(best == _hostIndex && _hosts[n].failures == _hosts[best].failures) {
+                best = n;
+            }
+        }
+        selectHost(best);
+    }
+
+    DEBUG_WEBSOCKETS("[WS-Client] reconnect in %lums (failures: %u)\n", _reconnectDelay, _reconnectFailures);
+}
+
+/**
+ * init a entry of the host list
+ * @param host WSclientHost_t *
+ * @param name const char *
+ * @param port uint16_t
+ */
+void WebSocketsClient::resetHost(WSclientHost_t * host, const char * name, uint16_t port) {
+    host->host     = name;
+    host->port     = port;
+    host->failures = 0;
+    host->ipValid  = false;
+    host->ipTime   = 0;
+    host->ipTTL    = 0;
+}
+
+/**
+ * @param host WSclientHost_t *
+ * @return true if the cached address of the host can be used
+ */
+bool WebSocketsClient::hostAddressValid(WSclientHost_t * host) {
+    if(!host->ipValid) {
+        return false;
+    }
+    if(host->ipTTL && (millis() - host->ipTime) >= host->ipTTL) {
+        host->ipValid = false;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * make a entry of the host list the current host
+ * @param index uint8_t
+ */
+void WebSocketsClient::selectHost(uint8_t index) {
+    if(index == _hostIndex || index >= _hostCount) {
+        return;
+    }
+    _hostIndex = index;
+    _host      = _hosts[index].host;
+    _port      = _hosts[index].port;
+    _stats.failovers++;
+    DEBUG_WEBSOCKETS("[WS-Client] failover to %s:%u\n", _host.c_str(), _port);
+}
+
 /**
  * send heartbeat ping to server in set intervals
  */
@@ -26,14 +26,82 @@
 #define WEBSOCKETSCLIENT_H_
 
 #include "WebSockets.h"
+#include "WebSocketsFrameWriter.h"
+
+#ifndef WEBSOCKETS_CLIENT_HOST_MAX
+// max hosts for failover (incl. the one of begin)
+#define WEBSOCKETS_CLIENT_HOST_MAX (3)
+#endif
+
+#ifndef WEBSOCKETS_CLIENT_DNS_CACHE_TTL
+// ms the address of a successful connection is reused for reconnects
+#define WEBSOCKETS_CLIENT_DNS_CACHE_TTL (5 * 60 * 1000)
+#endif
+
+#ifndef WEBSOCKETS_CLIENT_QUEUE_BATCH
+// max queued messages send per loop() call
+#define WEBSOCKETS_CLIENT_QUEUE_BATCH (4)
+#endif
+
+typedef enum {
+    WSqueueDrop_oldest,    ///< drop the oldest message to make room
+    WSqueueDrop_newest     ///< reject the new message
+} WSqueueDrop_t;
+
+typedef struct WSqueueMsg_s {
+    struct WSqueueMsg_s * next;
+    unsigned long time;    ///< millis when queued
+    WSopcode_t opcode;
+    size_t length;
+    uint8_t * payload;           ///< payload of the application, NULL = copy behind the entry
+    WSpayloadDeleter deleter;    ///< frees payload
+    String * str;                ///< String moved into the queue (payload points into it)
+    // followed by WEBSOCKETS_MAX_HEADER_SIZE + length byte (copy only)
+} WSqueueMsg_t;
+
+#define WS_QUEUE_MSG_DATA(msg) ((uint8_t *)((msg) + 1))
+
+typedef struct {
+    String host;
+    uint16_t port    = 0;
+    uint8_t failures = 0;    ///< failed connections in a row
+
+    IPAddress ip;                    ///< resolved address of host
+    bool ipValid         = false;    ///< ip is set
+    unsigned long ipTime = 0;        ///< millis when ip was resolved
+    uint32_t ipTTL       = 0;        ///< ms ip is valid, 0 = no expiry
+} WSclientHost_t;
+
+typedef struct {
+    uint32_t connectAttempts;      ///< tcp connects started
+    uint32_t connectFailures;      ///< tcp connects failed
+    uint32_t connects;             ///< successful websocket upgrades
+    uint32_t connectTime;          ///< ms of the last tcp connect (incl. dns and tls)
+    uint32_t handshakeTime;        ///< ms of the last http upgrade
+    uint32_t failovers;            ///< switches to a other host
+    uint32_t addressCacheHits;     ///< connects without name resolution
+    uint32_t networkReuses;        ///< connects with the network class of the last connection
+    uint32_t reconnectTime;        ///< ms from the last disconnect to the websocket upgrade
+    uint32_t heapBeforeConnect;    ///< free heap before the last tcp connect (0 = unknown)
+    uint32_t heapConnected;        ///< free heap after the last websocket upgrade (0 = unknown)
+    uint32_t queued;               ///< messages stored in the send queue
+    uint32_t queueSent;            ///< queued messages send after a reconnect
+    uint32_t queueDropped;         ///< queued messages dropped (full, expired, no memory)
+} WSclientStats_t;
+
+class WebSocketsClientGroup;
 
 class WebSocketsClient : protected WebSockets {
   public:
 #ifdef __AVR__
     typedef void (*WebSocketClientEvent)(WStype_t type, uint8_t * payload, size_t length);
+    typedef uint8_t * (*WebSocketClientBufferProvider)(size_t size);
 #else
     typedef std::function<void(WStype_t type, uint8_t * payload, size_t length)> WebSocketClientEvent;
+    typedef std::function<uint8_t *(size_t size)> WebSocketClientBufferProvider;
 #endif
+    // plain function with a user pointer, called directly (no std::function)
+    typedef void (*WebSocketClientEventArg)(void * arg, WStype_t type, uint8_t * payload, size_t length);
 
     WebSocketsClient(void);
     virtual ~WebSocketsClient(void);
@@ -79,12 +147,15 @@ class WebSocketsClient : protected WebSockets {
 
 #if(WEBSOCKETS_NETWORK_TYPE != NETWORK_ESP8266_ASYNC)
     void loop(void);
+    uint32_t nextTimeout(void);
 #else
     // Async interface not need a loop call
     void loop(void) __attribute__((deprecated)) {}
 #endif
 
     void onEvent(WebSocketClientEvent cbEvent);
+    void onEvent(WebSocketClientEventArg cbEvent, void * arg);
+    void onBuffer(WebSocketClientBufferProvider cbBuffer);
 
     bool sendTXT(uint8_t * payload, size_t length = 0, bool headerToPayload = false);
     bool sendTXT(const uint8_t * payload, size_t length = 0);
@@ -92,21 +163,52 @@ class WebSocketsClient : protected WebSockets {
     bool sendTXT(const char * payload, size_t length = 0);
     bool sendTXT(String & payload);
     bool sendTXT(char payload);
+    bool sendTXT(String && payload);
+    bool sendTXTOwned(uint8_t * payload, size_t length, WSpayloadDeleter deleter);
 
     bool sendBIN(uint8_t * payload, size_t length, bool headerToPayload = false);
     bool sendBIN(const uint8_t * payload, size_t length);
+    bool sendBINOwned(uint8_t * payload, size_t length, WSpayloadDeleter deleter);
+
+    bool sendStream(Stream & stream, size_t length = WEBSOCKETS_STREAM_UNTIL_END, bool text = false);
 
     bool sendPing(uint8_t * payload = NULL, size_t length = 0);
     bool sendPing(String & payload);
 
     void disconnect(void);
 
+    uint8_t * detachPayload(void);
+    static void releasePayload(uint8_t * payload);
+
+    void setSendQueue(size_t maxMessages, size_t maxBytes = 0, uint32_t maxAge = 0, WSqueueDrop_t drop = WSqueueDrop_oldest);
+    size_t queuedMessages(void);
+    void clearSendQueue(void);
+
     void setAuthorization(const char * user, const char * password);
     void setAuthorization(const char * auth);
 
     void setExtraHeaders(const char * extraHeaders = NULL);
 
     void setReconnectInterval(unsigned long time);
+    void setReconnectBackoff(unsigned long minInterval, unsigned long maxInterval, unsigned long stableTime = 10000);
+
+    bool addHost(const char * host, uint16_t port);
+    bool addHost(String host, uint16_t port);
+    void setFailoverThreshold(uint8_t failures);
+
+    bool setHostAddress(uint8_t index, IPAddress ip, uint32_t ttl = 0);
+    void setDnsCacheTTL(uint32_t ttl);
+    void setConnectTimeout(uint32_t connectTimeout, uint32_t handshakeTimeout = WEBSOCKETS_TCP_TIMEOUT);
+
+    void setLimits(const WSlimits_t & limits);
+    WSlimits_t getLimits(void);
+
+    void setReassembly(bool enable);
+
+    WebSocketsFrameWriter frameTXT(void);
+    WebSocketsFrameWriter frameBIN(void);
+
+    WSclientStats_t getStats(void);
 
     void enableHeartbeat(uint32_t pingInterval, uint32_t pongTimeout, uint8_t disconnectTimeoutCount);
     void disableHeartbeat();
@@ -114,9 +216,19 @@ class WebSocketsClient : protected WebSockets {
     bool isConnected(void);
 
   protected:
+    friend class WebSocketsClientGroup;
+
+    static bool sendFrameWriter(void * client, uint8_t num, WSopcode_t opcode, uint8_t * payload, size_t length);
+
     String _host;
     uint16_t _port;
 
+    String _url;                    ///< url of the http upgrade request
+    String _protocol;               ///< Sec-WebSocket-Protocol of the request
+    String _extraHeaders;           ///< extra http headers of the request
+    String _base64Authorization;    ///< Base64 encoded Auth request
+    String _plainAuthorization;     ///< Authorization header value
+
 #if defined(HAS_SSL)
 #ifdef SSL_AXTLS
     String _fingerprint;
@@ -149,32 +261,139 @@ class WebSocketsClient : protected WebSockets {
     WSclient_t _client;
 
     WebSocketClientEvent _cbEvent;
+    WebSocketClientEventArg _cbEventArg;
+    void * _cbEventArgPtr;
+    WebSocketClientBufferProvider _cbBuffer;
 
     unsigned long _lastConnectionFail;
-    unsigned long _reconnectInterval;
+    unsigned long _reconnectInterval;       ///< min. time between connection attempts
+    unsigned long _reconnectIntervalMax;    ///< backoff cap, 0 = fixed _reconnectInterval
+    unsigned long _reconnectStableTime;     ///< connection counts as stable after this time
+    unsigned long _reconnectDelay;          ///< time to wait for the next attempt
+    unsigned long _connectedSince;
+    uint8_t _reconnectFailures;             ///< failed / unstable connections in a row
     unsigned long _lastHeaderSent;
 
+    WSclientHost_t _hosts[WEBSOCKETS_CLIENT_HOST_MAX];
+    uint8_t _hostCount;
+    uint8_t _hostIndex;
+    uint8_t _failoverThreshold;
+    uint32_t _dnsCacheTTL;
+
+    uint32_t _connectTimeout;
+    WSlimits_t _limits;         ///< limits for the next connections (_client.limits for the running one)
+    bool _reassemble;           ///< reassemble fragmented messages (from the next connection on)
+    bool _connectPending;       ///< network class is prepared, connect on next loop()
+    bool _networkConfigured;    ///< tls settings are applied to the kept network class
+    unsigned long _disconnectTime;
+
+#if(WEBSOCKETS_NETWORK_TYPE != NETWORK_ESP8266_ASYNC)
+    WEBSOCKETS_NETWORK_CLASS * _tcpIdle;    ///< stopped network class, reused on reconnect
+#if defined(HAS_SSL)
+    WEBSOCKETS_NETWORK_SSL_CLASS * _sslIdle;
+#endif
+#endif
+#if defined(SSL_BARESSL)
+    BearSSL::Session _sslSession;    ///< tls session for resumption
+#endif
+
+    WSqueueMsg_t * _queueHead;
+    WSqueueMsg_t * _queueTail;
+    size_t _queueCount;
+    size_t _queueBytes;
+    size_t _queueMaxMessages;    ///< 0 = queue disabled
+    size_t _queueMaxBytes;       ///< 0 = no limit
+    uint32_t _queueMaxAge;       ///< ms, 0 = no limit
+    WSqueueDrop_t _queueDrop;
+
+    WSclientStats_t _stats;
+
+    WebSocketsClientGroup * _group;    ///< group running this client, NULL = own loop()
+    WebSocketsClient * _groupNext;
+    unsigned long _groupWake;          ///< millis when the group looks at the client again
+
     void messageReceived(WSclient_t * client, WSopcode_t opcode, uint8_t * payload, size_t length, bool fin);
 
     void clientDisconnect(WSclient_t * client);
     bool clientIsConnected(WSclient_t * client);
 
+    bool initHandshake(void);
+    void freeHandshake(void);
+
 #if(WEBSOCKETS_NETWORK_TYPE != NETWORK_ESP8266_ASYNC)
     void handleClientData(void);
+    void handleConnect(void);
 #endif
 
     void sendHeader(WSclient_t * client);
     void handleHeader(WSclient_t * client, String * headerLine);
+    void handleHeaderLine(WSclient_t * client, char * headerLine, size_t length);
+    size_t buildHeader(WSclient_t * client, char * out);
 
     void connectedCb();
     void connectFailedCb();
 
     void handleHBPing();    // send ping in specified intervals
 
+    /**
+     * yield to the system, a WebSocketsClientGroup yields once for many clients
+     */
+    void yieldLoop(void) {
+        if(!_group) {
+            WEBSOCKETS_YIELD();
+        }
+    }
+
+    void handleReconnectPolicy(WSclient_t * client);
+    void selectHost(uint8_t index);
+    void resetHost(WSclientHost_t * host, const char * name, uint16_t port);
+    bool hostAddressValid(WSclientHost_t * host);
+
+    bool queueMessage(WSopcode_t opcode, uint8_t * payload, size_t length, bool headerToPayload);
+    bool queueOwned(WSopcode_t opcode, uint8_t * payload, size_t length, WSpayloadDeleter deleter, String * str);
+    WSqueueMsg_t * queueAlloc(size_t length, size_t extra);
+    void queueAppend(WSqueueMsg_t * msg, WSopcode_t opcode, size_t length);
+    bool sendOwned(WSopcode_t opcode, uint8_t * payload, size_t length, WSpayloadDeleter deleter);
+    void dequeueMessage(void);
+    void expireQueue(void);
+    void handleSendQueue(size_t maxMessages);
+
+    /**
+     * calculates the wait time before the next connection attempt
+     * default: exponential backoff with jitter between _reconnectInterval and _reconnectIntervalMax
+     * Note: can be override
+     * @param failures uint8_t failed / unstable connections in a row
+     * @return ms
+     */
+    virtual unsigned long nextReconnectDelay(uint8_t failures) {
+        if(_reconnectIntervalMax <= _reconnectInterval) {
+            return _reconnectInterval;
+        }
+        unsigned long cap = _reconnectInterval;
+        while(failures-- > 0 && cap < _reconnectIntervalMax) {
+            cap <<= 1;
+        }
+        cap = std::min(cap, _reconnectIntervalMax);
+        return random(_reconnectInterval, cap + 1);
+    }
+
 #if(WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP8266_ASYNC)
     void asyncConnect();
 #endif
 
+    /**
+     * asks the buffer provider of the app for the payload buffer
+     * @param client WSclient_t *
+     * @param size size_t
+     * @return buffer or NULL to use malloc
+     */
+    uint8_t * provideBuffer(WSclient_t * client, size_t size) {
+        if(_cbBuffer) {
+            return _cbBuffer(size);
+        }
+        return NULL;
+    }
+
     /**
      * called for sending a Event to the app
      * @param type WStype_t
@@ -182,7 +401,9 @@ class WebSocketsClient : protected WebSockets {
      * @param length size_t
      */
     virtual void runCbEvent(WStype_t type, uint8_t * payload, size_t length) {
-        if(_cbEvent) {
+        if(_cbEventArg) {
+            _cbEventArg(_cbEventArgPtr, type, payload, length);
+        } else if(_cbEvent) {
             _cbEvent(type, payload, length);
         }
     }
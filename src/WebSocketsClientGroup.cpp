@@ -0,0 +1,149 @@
+/**
+ * @file WebSocketsClientGroup.cpp
+ *
+ * This file is part of the WebSockets for Arduino.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "WebSockets.h"
+#include "WebSocketsClientGroup.h"
+
+#if(WEBSOCKETS_NETWORK_TYPE != NETWORK_ESP8266_ASYNC)
+
+WebSocketsClientGroup::WebSocketsClientGroup() {
+    _first = NULL;
+    _count = 0;
+}
+
+WebSocketsClientGroup::~WebSocketsClientGroup() {
+    while(_first) {
+        remove(_first);
+    }
+}
+
+/**
+ * add a client to the group, the client must not be used with its own loop() any more
+ * @param client WebSocketsClient *
+ * @return true if ok
+ */
+bool WebSocketsClientGroup::add(WebSocketsClient * client) {
+    if(!client || client->_group) {
+        return false;
+    }
+
+    client->_group     = this;
+    client->_groupNext = _first;
+    client->_groupWake = millis();
+    _first             = client;
+    _count++;
+    return true;
+}
+
+/**
+ * remove a client from the group
+ * Note: do not remove a other client of the group from the event callback
+ * @param client WebSocketsClient *
+ * @return true if ok
+ */
+bool WebSocketsClientGroup::remove(WebSocketsClient * client) {
+    if(!client || client->_group != this) {
+        return false;
+    }
+
+    WebSocketsClient ** c = &_first;
+    while(*c && *c != client) {
+        c = &(*c)->_groupNext;
+    }
+    if(*c) {
+        *c = client->_groupNext;
+        _count--;
+    }
+
+    client->_group     = NULL;
+    client->_groupNext = NULL;
+    return true;
+}
+
+/**
+ * @return clients in the group
+ */
+size_t WebSocketsClientGroup::count(void) {
+    return _count;
+}
+
+/**
+ * client has received data or a timer of it is expired
+ * polls the network class, the network classes have no readiness notification
+ * @param client WebSocketsClient *
+ * @param t unsigned long   millis
+ */
+bool WebSocketsClientGroup::isReady(WebSocketsClient * client, unsigned long t) {
+    if((long)(t - client->_groupWake) >= 0) {
+        return true;
+    }
+    if(client->_client.tcp && client->_client.status != WSC_NOT_CONNECTED && client->_client.tcp->available() > 0) {
+        return true;
+    }
+    return false;
+}
+
+/**
+ * services all clients with work to do
+ */
+void WebSocketsClientGroup::loop(void) {
+    unsigned long t = millis();
+    uint16_t n      = 0;
+
+    WebSocketsClient * client = _first;
+    while(client) {
+        WebSocketsClient * next = client->_groupNext;
+
+        if(isReady(client, t)) {
+            client->loop();
+
+            uint32_t timeout   = std::min(client->nextTimeout(), (uint32_t)WEBSOCKETS_CLIENT_GROUP_RECHECK);
+            client->_groupWake = millis() + timeout;
+
+            if(++n >= WEBSOCKETS_CLIENT_GROUP_YIELD) {
+                WEBSOCKETS_YIELD();
+                n = 0;
+            }
+        }
+
+        client = next;
+    }
+    WEBSOCKETS_YIELD();
+}
+
+/**
+ * time until loop() has work to do, can be used to sleep between loop() calls
+ * @return ms, 0 = call loop() now, WEBSOCKETS_NO_TIMEOUT = no client in the group
+ */
+uint32_t WebSocketsClientGroup::nextTimeout(void) {
+    uint32_t timeout = WEBSOCKETS_NO_TIMEOUT;
+    unsigned long t  = millis();
+
+    for(WebSocketsClient * client = _first; client; client = client->_groupNext) {
+        if(isReady(client, t)) {
+            return 0;
+        }
+        timeout = std::min(timeout, (uint32_t)(client->_groupWake - t));
+    }
+    return timeout;
+}
+
+#endif
@@ -0,0 +1,66 @@
+/**
+ * @file WebSocketsClientGroup.h
+ *
+ * This file is part of the WebSockets for Arduino.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef WEBSOCKETSCLIENTGROUP_H_
+#define WEBSOCKETSCLIENTGROUP_H_
+
+#include "WebSocketsClient.h"
+
+#if(WEBSOCKETS_NETWORK_TYPE != NETWORK_ESP8266_ASYNC)
+
+#ifndef WEBSOCKETS_CLIENT_GROUP_RECHECK
+// max ms a idle client is not looked at (catches changes done by the application)
+#define WEBSOCKETS_CLIENT_GROUP_RECHECK (50)
+#endif
+
+#ifndef WEBSOCKETS_CLIENT_GROUP_YIELD
+// yield after this many serviced clients
+#define WEBSOCKETS_CLIENT_GROUP_YIELD (16)
+#endif
+
+/**
+ * runs many WebSocketsClient from one loop() call
+ * the clients are polled: every loop() checks the received data of each client (tcp->available()),
+ * only clients with data or a expired timer (see WebSocketsClient::nextTimeout) are serviced
+ * the events are the same as with WebSocketsClient::loop()
+ */
+class WebSocketsClientGroup {
+  public:
+    WebSocketsClientGroup(void);
+    virtual ~WebSocketsClientGroup(void);
+
+    bool add(WebSocketsClient * client);
+    bool remove(WebSocketsClient * client);
+    size_t count(void);
+
+    void loop(void);
+    uint32_t nextTimeout(void);
+
+  protected:
+    WebSocketsClient * _first;
+    size_t _count;
+
+    bool isReady(WebSocketsClient * client, unsigned long t);
+};
+
+#endif
+
+#endif /* WEBSOCKETSCLIENTGROUP_H_ */
@@ -0,0 +1,168 @@
+/**
+ * @file WebSocketsFrameWriter.cpp
+ *
+ * This file is part of the WebSockets for Arduino.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "WebSockets.h"
+#include "WebSocketsFrameWriter.h"
+
+// buffer given back by the last writer, handed to the next one
+// not locked: single writer rule, all writers are used from the same task
+// (the one calling loop() / handling the events, like the rest of the library)
+static uint8_t * poolBuffer;
+static size_t poolSize;
+
+/**
+ * @param sendFunc WSframeSendFunc  sends the payload (with header room) as one message
+ * @param owner void *              passed to sendFunc
+ * @param num uint8_t               passed to sendFunc (client id)
+ * @param opcode WSopcode_t         WSop_text or WSop_binary
+ */
+WebSocketsFrameWriter::WebSocketsFrameWriter(WSframeSendFunc sendFunc, void * owner, uint8_t num, WSopcode_t opcode) {
+    _sendFunc = sendFunc;
+    _owner    = owner;
+    _num      = num;
+    _opcode   = opcode;
+    _buffer   = NULL;
+    _size     = 0;
+    _length   = 0;
+    _failed   = false;
+}
+
+WebSocketsFrameWriter::WebSocketsFrameWriter(WebSocketsFrameWriter && other) {
+    _sendFunc = other._sendFunc;
+    _owner    = other._owner;
+    _num      = other._num;
+    _opcode   = other._opcode;
+    _buffer   = other._buffer;
+    _size     = other._size;
+    _length   = other._length;
+    _failed   = other._failed;
+
+    other._buffer = NULL;
+    other._size   = 0;
+    other._length = 0;
+    other._failed = true;
+}
+
+WebSocketsFrameWriter::~WebSocketsFrameWriter() {
+    release();
+}
+
+size_t WebSocketsFrameWriter::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t WebSocketsFrameWriter::write(const uint8_t * buffer, size_t size) {
+    if(_failed || !reserve(_length + size)) {
+        return 0;
+    }
+    memcpy(_buffer + WEBSOCKETS_MAX_HEADER_SIZE + _length, buffer, size);
+    _length += size;
+    return size;
+}
+
+/**
+ * the payload written so far (0 terminated)
+ * @return uint8_t *, NULL if nothing is written
+ */
+uint8_t * WebSocketsFrameWriter::data(void) {
+    if(!_buffer) {
+        return NULL;
+    }
+    _buffer[WEBSOCKETS_MAX_HEADER_SIZE + _length] = 0x00;
+    return _buffer + WEBSOCKETS_MAX_HEADER_SIZE;
+}
+
+size_t WebSocketsFrameWriter::length(void) {
+    return _length;
+}
+
+/**
+ * send the written payload as one message, the header is put in front of it (no copy)
+ * @return true if ok
+ */
+bool WebSocketsFrameWriter::send(void) {
+    if(_failed || !_sendFunc || !reserve(_length)) {
+        release();
+        return false;
+    }
+    // 0 terminated like the other payload buffers
+    _buffer[WEBSOCKETS_MAX_HEADER_SIZE + _length] = 0x00;
+
+    bool ret = _sendFunc(_owner, _num, _opcode, _buffer, _length);
+
+    release();
+    _failed = true;
+    return ret;
+}
+
+/**
+ * make room for size byte of payload, the buffer grows by doubling
+ * @param size size_t
+ * @return true if ok
+ */
+bool WebSocketsFrameWriter::reserve(size_t size) {
+    if(_buffer && size <= _size) {
+        return true;
+    }
+
+    if(!_buffer && poolBuffer && size <= poolSize) {
+        _buffer    = poolBuffer;
+        _size      = poolSize;
+        poolBuffer = NULL;
+        poolSize   = 0;
+        return true;
+    }
+
+    size_t newSize = std::max(size, std::max(_size * 2, (size_t)(64 - WEBSOCKETS_MAX_HEADER_SIZE - 1)));
+
+    // + 1 for the 0 termination
+    uint8_t * buffer = (uint8_t *)WebSockets::memAlloc(WEBSOCKETS_MAX_HEADER_SIZE + newSize + 1);
+    if(!buffer) {
+        DEBUG_WEBSOCKETS("[WS][FrameWriter] no memory for %u byte!\n", newSize);
+        _failed = true;
+        return false;
+    }
+    if(_buffer) {
+        memcpy(buffer + WEBSOCKETS_MAX_HEADER_SIZE, _buffer + WEBSOCKETS_MAX_HEADER_SIZE, _length);
+        WebSockets::memFree(_buffer);
+    }
+    _buffer = buffer;
+    _size   = newSize;
+    return true;
+}
+
+/**
+ * give the buffer back, small ones are kept for the next writer
+ */
+void WebSocketsFrameWriter::release(void) {
+    if(_buffer) {
+        if(_size <= WEBSOCKETS_FRAME_WRITER_KEEP && _size > poolSize) {
+            WebSockets::memFree(poolBuffer);
+            poolBuffer = _buffer;
+            poolSize   = _size;
+        } else {
+            WebSockets::memFree(_buffer);
+        }
+    }
+    _buffer = NULL;
+    _size   = 0;
+    _length = 0;
+}
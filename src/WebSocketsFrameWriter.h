@@ -0,0 +1,79 @@
+/**
+ * @file WebSocketsFrameWriter.h
+ *
+ * This file is part of the WebSockets for Arduino.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef WEBSOCKETSFRAMEWRITER_H_
+#define WEBSOCKETSFRAMEWRITER_H_
+
+#include "WebSockets.h"
+
+#ifndef WEBSOCKETS_FRAME_WRITER_KEEP
+// writer buffers up to this size are kept for the next writer
+#ifdef WEBSOCKETS_USE_BIG_MEM
+#define WEBSOCKETS_FRAME_WRITER_KEEP (1024)
+#else
+#define WEBSOCKETS_FRAME_WRITER_KEEP (256)
+#endif
+#endif
+
+/**
+ * builds a message in place: print / printf / write append to a buffer
+ * that has the room for the websocket header in front (see headerToPayload of sendFrame)
+ * send() adds the header there and sends without copying the payload
+ * get one from WebSocketsServerCore::frameTXT(), WebSocketsClient::frameTXT(), SocketIOclient::frameEVENT(), ...
+ * one writer sends one message
+ * small buffers are pooled for the next writer (not locked), use the writers from one task only
+ */
+class WebSocketsFrameWriter : public Print {
+  public:
+    typedef bool (*WSframeSendFunc)(void * owner, uint8_t num, WSopcode_t opcode, uint8_t * payload, size_t length);
+
+    WebSocketsFrameWriter(WSframeSendFunc sendFunc, void * owner, uint8_t num, WSopcode_t opcode);
+    WebSocketsFrameWriter(WebSocketsFrameWriter && other);
+    virtual ~WebSocketsFrameWriter(void);
+
+    WebSocketsFrameWriter(const WebSocketsFrameWriter &) = delete;
+    WebSocketsFrameWriter & operator=(const WebSocketsFrameWriter &) = delete;
+
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t * buffer, size_t size) override;
+    using Print::write;
+
+    uint8_t * data(void);
+    size_t length(void);
+
+    bool send(void);
+
+  protected:
+    WSframeSendFunc _sendFunc;
+    void * _owner;
+    uint8_t _num;
+    WSopcode_t _opcode;
+
+    uint8_t * _buffer;    ///< WEBSOCKETS_MAX_HEADER_SIZE header room + payload + 0 termination
+    size_t _size;         ///< payload capacity of _buffer
+    size_t _length;       ///< payload written
+    bool _failed;         ///< out of memory or already sent, send() fails
+
+    bool reserve(size_t size);
+    void release(void);
+};
+
+#endif /* WEBSOCKETSFRAMEWRITER_H_ */
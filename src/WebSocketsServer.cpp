@@ -33,36 +33,43 @@
 #endif    // defined __has_include
 #endif
 
-WebSocketsServerCore::WebSocketsServerCore(const String & origin, const String & protocol) {
+WebSocketsServerBase::WebSocketsServerBase(WSclient_t * clients, uint8_t clientMax, const String & origin, const String & protocol) {
+    _clients                = clients;
+    _clientMax              = clientMax;
     _origin                 = origin;
     _protocol               = protocol;
     _runnning               = false;
+    _draining               = false;
+    _drainStart             = 0;
+    _drainTimeout           = 0;
     _pingInterval           = 0;
     _pongTimeout            = 0;
     _disconnectTimeoutCount = 0;
+    _reassemble             = false;
 
-    _cbEvent = NULL;
+    _cbEvent       = NULL;
+    _cbEventArg    = NULL;
+    _cbEventArgPtr = NULL;
+    _cbBuffer      = NULL;
 
     _httpHeaderValidationFunc = NULL;
     _mandatoryHttpHeaders     = NULL;
     _mandatoryHttpHeaderCount = 0;
-}
 
-WebSocketsServer::WebSocketsServer(uint16_t port, const String & origin, const String & protocol)
-    : WebSocketsServerCore(origin, protocol) {
-    _port = port;
+    _allowHeartbeat     = true;
+    _allowAuthorization = true;
 
-    _server = new WEBSOCKETS_NETWORK_SERVER_CLASS(port);
+    _port          = 0;
+    _listenerCount = 0;
+}
 
-#if(WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP8266_ASYNC)
-    _server->onClient([](void * s, AsyncClient * c) {
-        ((WebSocketsServerCore *)s)->newClient(new AsyncTCPbuffer(c));
-    },
-        this);
-#endif
+WebSocketsServerBase::WebSocketsServerBase(WSclient_t * clients, uint8_t clientMax, uint16_t port, const String & origin, const String & protocol)
+    : WebSocketsServerBase(clients, clientMax, origin, protocol) {
+    _port = port;
+    addListener(port);
 }
 
-WebSocketsServerCore::~WebSocketsServerCore() {
+WebSocketsServerBase::~WebSocketsServerBase() {
     // disconnect all clients
     close();
 
@@ -70,26 +77,26 @@ WebSocketsServerCore::~WebSocketsServerCore() {
         delete[] _mandatoryHttpHeaders;
 
     _mandatoryHttpHeaderCount = 0;
-}
 
-WebSocketsServer::~WebSocketsServer() {
 #if(WEBSOCKETS_NETWORK_TYPE == NETWORK_WIFI_NINA) || (WEBSOCKETS_NETWORK_TYPE == NETWORK_SAMD_SEED)
     // does not support delete (no destructor)
 #else
-    delete _server;
+    for(uint8_t i = 0; i < _listenerCount; i++) {
+        memDelete(_listeners[i]);
+    }
 #endif
 }
 
 /**
  * called to initialize the Websocket server
  */
-void WebSocketsServerCore::begin(void) {
+void WebSocketsServerBase::begin(void) {
     // adjust clients storage:
     // _clients[i]'s constructor are already called,
     // all its members are initialized to their default value,
     // except the ones explicitly detailed in WSclient_t() constructor.
     // Then we need to initialize some members to non-trivial values:
-    for(int i = 0; i < WEBSOCKETS_SERVER_CLIENT_MAX; i++) {
+    for(uint8_t i = 0; i < _clientMax; i++) {
         _clients[i].init(i, _pingInterval, _pongTimeout, _disconnectTimeoutCount);
     }
 
@@ -108,27 +115,140 @@ void WebSocketsServerCore::begin(void) {
 #endif
 
     _runnning = true;
+    _draining = false;
 
     DEBUG_WEBSOCKETS("[WS-Server] Websocket Version: " WEBSOCKETS_VERSION "\n");
+    DEBUG_WEBSOCKETS("[WS-Server] connection size: %u byte (+ %u byte while the handshake runs)\n", sizeof(WSclient_t), sizeof(WSclientHandshake_t));
+
+    for(uint8_t i = 0; i < _listenerCount; i++) {
+        _listeners[i]->begin();
+    }
+    if(_listenerCount) {
+        DEBUG_WEBSOCKETS("[WS-Server] Server Started.\n");
+    }
 }
 
-void WebSocketsServerCore::close(void) {
+void WebSocketsServerBase::close(void) {
     _runnning = false;
+    _draining = false;
     disconnect();
 
     // restore _clients[] to their initial state
     // before next call to ::begin()
-    for(int i = 0; i < WEBSOCKETS_SERVER_CLIENT_MAX; i++) {
+    for(uint8_t i = 0; i < _clientMax; i++) {
         _clients[i] = WSclient_t();
     }
+
+    for(uint8_t i = 0; i < _listenerCount; i++) {
+        closeListener(_listeners[i]);
+    }
+}
+
+/**
+ * stop accepting new clients and close all connected clients gracefully
+ * the close handshake is handled by loop(), clients not answering
+ * within the timeout get dropped
+ * NETWORK_ESP8266_ASYNC has no loop(), the timeout is checked when a client
+ * sends data or disconnects and by drainPending(), poll it to wait for the drain
+ * @param timeout uint32_t ms to wait for the close of the clients
+ */
+void WebSocketsServerBase::drain(uint32_t timeout) {
+    _draining     = true;
+    _drainStart   = millis();
+    _drainTimeout = timeout;
+
+    WSclient_t * client;
+    for(uint8_t i = 0; i < _clientMax; i++) {
+        client = &_clients[i];
+        if(!clientIsConnected(client)) {
+            continue;
+        }
+        if(client->status == WSC_CONNECTED) {
+            // 1001 = going away
+            if(!clientClose(client, 1001)) {
+                clientDisconnect(client);
+            }
+        } else if(client->status != WSC_CLOSING) {
+            // still in the handshake
+            clientDisconnect(client);
+        }
+        WEBSOCKETS_YIELD();
+    }
+    DEBUG_WEBSOCKETS("[WS-Server] draining, %d clients pending\n", drainPending());
+}
+
+/**
+ * @return true if drain() is in progress or done
+ */
+bool WebSocketsServerBase::isDraining(void) {
+    return _draining;
+}
+
+/**
+ * drop the clients not closed within the drain timeout
+ * called by loop(), on NETWORK_ESP8266_ASYNC by the client callbacks and drainPending()
+ */
+void WebSocketsServerBase::handleDrain(void) {
+    if(!_draining || (millis() - _drainStart) < _drainTimeout) {
+        return;
+    }
+    WSclient_t * client;
+    for(uint8_t i = 0; i < _clientMax; i++) {
+        client = &_clients[i];
+        if(clientIsConnected(client)) {
+            DEBUG_WEBSOCKETS("[WS-Server][%d] drain timeout, drop client\n", client->num);
+            clientDisconnect(client);
+        }
+    }
+}
+
+/**
+ * @return number of clients not closed yet
+ * NETWORK_ESP8266_ASYNC: also drops the clients left after the drain timeout
+ */
+int WebSocketsServerBase::drainPending(void) {
+#if(WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP8266_ASYNC)
+    handleDrain();
+#endif
+    int count = 0;
+    for(uint8_t i = 0; i < _clientMax; i++) {
+        if(clientIsConnected(&_clients[i])) {
+            count++;
+        }
+    }
+    return count;
 }
 
 /**
  * set callback function
  * @param cbEvent WebSocketServerEvent
  */
-void WebSocketsServerCore::onEvent(WebSocketServerEvent cbEvent) {
-    _cbEvent = cbEvent;
+void WebSocketsServerBase::onEvent(WebSocketServerEvent cbEvent) {
+    _cbEvent    = cbEvent;
+    _cbEventArg = NULL;
+}
+
+/**
+ * set callback function with a user pointer
+ * called directly, no std::function in between
+ * @param cbEvent WebSocketServerEventArg
+ * @param arg void *  passed as first argument to cbEvent
+ */
+void WebSocketsServerBase::onEvent(WebSocketServerEventArg cbEvent, void * arg) {
+    _cbEvent       = NULL;
+    _cbEventArg    = cbEvent;
+    _cbEventArgPtr = arg;
+}
+
+/**
+ * set the buffer provider for received payloads
+ * the provider gets the client id and the needed size (payload length + 1)
+ * and returns a buffer of the app or NULL to use malloc
+ * the buffer is used until the event callback returns and is never freed by the library
+ * @param cbBuffer WebSocketServerBufferProvider
+ */
+void WebSocketsServerBase::onBuffer(WebSocketServerBufferProvider cbBuffer) {
+    _cbBuffer = cbBuffer;
 }
 
 /*
@@ -137,7 +257,7 @@ void WebSocketsServerCore::onEvent(WebSocketServerEvent cbEvent) {
  * @param mandatoryHttpHeaders[] const char* ///< the array of named http headers considered to be mandatory / must be present in order for websocket upgrade to succeed
  * @param mandatoryHttpHeaderCount size_t ///< the number of items in the mandatoryHttpHeaders array
  */
-void WebSocketsServerCore::onValidateHttpHeader(
+void WebSocketsServerBase::onValidateHttpHeader(
     WebSocketServerHttpHeaderValFunc validationFunc,
     const char * mandatoryHttpHeaders[],
     size_t mandatoryHttpHeaderCount) {
@@ -162,8 +282,8 @@ void WebSocketsServerCore::onValidateHttpHeader(
  * @param headerToPayload bool  (see sendFrame for more details)
  * @return true if ok
  */
-bool WebSocketsServerCore::sendTXT(uint8_t num, uint8_t * payload, size_t length, bool headerToPayload) {
-    if(num >= WEBSOCKETS_SERVER_CLIENT_MAX) {
+bool WebSocketsServerBase::sendTXT(uint8_t num, uint8_t * payload, size_t length, bool headerToPayload) {
+    if(num >= _clientMax) {
         return false;
     }
     if(length == 0) {
@@ -176,19 +296,19 @@ bool WebSocketsServerCore::sendTXT(uint8_t num, uint8_t * payload, size_t length
     return false;
 }
 
-bool WebSocketsServerCore::sendTXT(uint8_t num, const uint8_t * payload, size_t length) {
+bool WebSocketsServerBase::sendTXT(uint8_t num, const uint8_t * payload, size_t length) {
     return sendTXT(num, (uint8_t *)payload, length);
 }
 
-bool WebSocketsServerCore::sendTXT(uint8_t num, char * payload, size_t length, bool headerToPayload) {
+bool WebSocketsServerBase::sendTXT(uint8_t num, char * payload, size_t length, bool headerToPayload) {
     return sendTXT(num, (uint8_t *)payload, length, headerToPayload);
 }
 
-bool WebSocketsServerCore::sendTXT(uint8_t num, const char * payload, size_t length) {
+bool WebSocketsServerBase::sendTXT(uint8_t num, const char * payload, size_t length) {
     return sendTXT(num, (uint8_t *)payload, length);
 }
 
-bool WebSocketsServerCore::sendTXT(uint8_t num, String & payload) {
+bool WebSocketsServerBase::sendTXT(uint8_t num, String & payload) {
     return sendTXT(num, (uint8_t *)payload.c_str(), payload.length());
 }
 
@@ -199,14 +319,14 @@ bool WebSocketsServerCore::sendTXT(uint8_t num, String & payload) {
  * @param headerToPayload bool  (see sendFrame for more details)
  * @return true if ok
  */
-bool WebSocketsServerCore::broadcastTXT(uint8_t * payload, size_t length, bool headerToPayload) {
+bool WebSocketsServerBase::broadcastTXT(uint8_t * payload, size_t length, bool headerToPayload) {
     WSclient_t * client;
     bool ret = true;
     if(length == 0) {
         length = strlen((const char *)payload);
     }
 
-    for(uint8_t i = 0; i < WEBSOCKETS_SERVER_CLIENT_MAX; i++) {
+    for(uint8_t i = 0; i < _clientMax; i++) {
         client = &_clients[i];
         if(clientIsConnected(client)) {
             if(!sendFrame(client, WSop_text, payload, length, true, headerToPayload)) {
@@ -218,19 +338,19 @@ bool WebSocketsServerCore::broadcastTXT(uint8_t * payload, size_t length, bool h
     return ret;
 }
 
-bool WebSocketsServerCore::broadcastTXT(const uint8_t * payload, size_t length) {
+bool WebSocketsServerBase::broadcastTXT(const uint8_t * payload, size_t length) {
     return broadcastTXT((uint8_t *)payload, length);
 }
 
-bool WebSocketsServerCore::broadcastTXT(char * payload, size_t length, bool headerToPayload) {
+bool WebSocketsServerBase::broadcastTXT(char * payload, size_t length, bool headerToPayload) {
     return broadcastTXT((uint8_t *)payload, length, headerToPayload);
 }
 
-bool WebSocketsServerCore::broadcastTXT(const char * payload, size_t length) {
+bool WebSocketsServerBase::broadcastTXT(const char * payload, size_t length) {
     return broadcastTXT((uint8_t *)payload, length);
 }
 
-bool WebSocketsServerCore::broadcastTXT(String & payload) {
+bool WebSocketsServerBase::broadcastTXT(String & payload) {
     return broadcastTXT((uint8_t *)payload.c_str(), payload.length());
 }
 
@@ -242,8 +362,8 @@ bool WebSocketsServerCore::broadcastTXT(String & payload) {
  * @param headerToPayload bool  (see sendFrame for more details)
  * @return true if ok
  */
-bool WebSocketsServerCore::sendBIN(uint8_t num, uint8_t * payload, size_t length, bool headerToPayload) {
-    if(num >= WEBSOCKETS_SERVER_CLIENT_MAX) {
+bool WebSocketsServerBase::sendBIN(uint8_t num, uint8_t * payload, size_t length, bool headerToPayload) {
+    if(num >= _clientMax) {
         return false;
     }
     WSclient_t * client = &_clients[num];
@@ -253,10 +373,25 @@ bool WebSocketsServerCore::sendBIN(uint8_t num, uint8_t * payload, size_t length
     return false;
 }
 
-bool WebSocketsServerCore::sendBIN(uint8_t num, const uint8_t * payload, size_t length) {
+bool WebSocketsServerBase::sendBIN(uint8_t num, const uint8_t * payload, size_t length) {
     return sendBIN(num, (uint8_t *)payload, length);
 }
 
+/**
+ * send data read from a stream (file, flash, ...) without a buffer for the whole payload
+ * @param num uint8_t client id
+ * @param stream Stream &
+ * @param length size_t  payload length, WEBSOCKETS_STREAM_UNTIL_END to send until stream.available() is 0
+ * @param text bool  send as text message
+ * @return true if ok
+ */
+bool WebSocketsServerBase::sendStream(uint8_t num, Stream & stream, size_t length, bool text) {
+    if(num >= _clientMax) {
+        return false;
+    }
+    return WebSockets::sendStream(&_clients[num], (text ? WSop_text : WSop_binary), stream, length);
+}
+
 /**
  * send binary data to client all
  * @param payload uint8_t *
@@ -264,10 +399,10 @@ bool WebSocketsServerCore::sendBIN(uint8_t num, const uint8_t * payload, size_t
  * @param headerToPayload bool  (see sendFrame for more details)
  * @return true if ok
  */
-bool WebSocketsServerCore::broadcastBIN(uint8_t * payload, size_t length, bool headerToPayload) {
+bool WebSocketsServerBase::broadcastBIN(uint8_t * payload, size_t length, bool headerToPayload) {
     WSclient_t * client;
     bool ret = true;
-    for(uint8_t i = 0; i < WEBSOCKETS_SERVER_CLIENT_MAX; i++) {
+    for(uint8_t i = 0; i < _clientMax; i++) {
         client = &_clients[i];
         if(clientIsConnected(client)) {
             if(!sendFrame(client, WSop_binary, payload, length, true, headerToPayload)) {
@@ -279,7 +414,7 @@ bool WebSocketsServerCore::broadcastBIN(uint8_t * payload, size_t length, bool h
     return ret;
 }
 
-bool WebSocketsServerCore::broadcastBIN(const uint8_t * payload, size_t length) {
+bool WebSocketsServerBase::broadcastBIN(const uint8_t * payload, size_t length) {
     return broadcastBIN((uint8_t *)payload, length);
 }
 
@@ -290,8 +425,8 @@ bool WebSocketsServerCore::broadcastBIN(const uint8_t * payload, size_t length)
  * @param length size_t
  * @return true if ping is send out
  */
-bool WebSocketsServerCore::sendPing(uint8_t num, uint8_t * payload, size_t length) {
-    if(num >= WEBSOCKETS_SERVER_CLIENT_MAX) {
+bool WebSocketsServerBase::sendPing(uint8_t num, uint8_t * payload, size_t length) {
+    if(num >= _clientMax) {
         return false;
     }
     WSclient_t * client = &_clients[num];
@@ -301,7 +436,7 @@ bool WebSocketsServerCore::sendPing(uint8_t num, uint8_t * payload, size_t lengt
     return false;
 }
 
-bool WebSocketsServerCore::sendPing(uint8_t num, String & payload) {
+bool WebSocketsServerBase::sendPing(uint8_t num, String & payload) {
     return sendPing(num, (uint8_t *)payload.c_str(), payload.length());
 }
 
@@ -311,10 +446,10 @@ bool WebSocketsServerCore::sendPing(uint8_t num, String & payload) {
  * @param length size_t
  * @return true if ping is send out
  */
-bool WebSocketsServerCore::broadcastPing(uint8_t * payload, size_t length) {
+bool WebSocketsServerBase::broadcastPing(uint8_t * payload, size_t length) {
     WSclient_t * client;
     bool ret = true;
-    for(uint8_t i = 0; i < WEBSOCKETS_SERVER_CLIENT_MAX; i++) {
+    for(uint8_t i = 0; i < _clientMax; i++) {
         client = &_clients[i];
         if(clientIsConnected(client)) {
             if(!sendFrame(client, WSop_ping, payload, length)) {
@@ -326,16 +461,16 @@ bool WebSocketsServerCore::broadcastPing(uint8_t * payload, size_t length) {
     return ret;
 }
 
-bool WebSocketsServerCore::broadcastPing(String & payload) {
+bool WebSocketsServerBase::broadcastPing(String & payload) {
     return broadcastPing((uint8_t *)payload.c_str(), payload.length());
 }
 
 /**
  * disconnect all clients
  */
-void WebSocketsServerCore::disconnect(void) {
+void WebSocketsServerBase::disconnect(void) {
     WSclient_t * client;
-    for(uint8_t i = 0; i < WEBSOCKETS_SERVER_CLIENT_MAX; i++) {
+    for(uint8_t i = 0; i < _clientMax; i++) {
         client = &_clients[i];
         if(clientIsConnected(client)) {
             WebSockets::clientDisconnect(client, 1000);
@@ -347,8 +482,8 @@ void WebSocketsServerCore::disconnect(void) {
  * disconnect one client
  * @param num uint8_t client id
  */
-void WebSocketsServerCore::disconnect(uint8_t num) {
-    if(num >= WEBSOCKETS_SERVER_CLIENT_MAX) {
+void WebSocketsServerBase::disconnect(uint8_t num) {
+    if(num >= _clientMax) {
         return;
     }
     WSclient_t * client = &_clients[num];
@@ -357,12 +492,38 @@ void WebSocketsServerCore::disconnect(uint8_t num) {
     }
 }
 
+/**
+ * takes the payload of a WStype_TEXT / WStype_BIN / WStype_FRAGMENT* event
+ * only valid inside the event callback, the buffer is not freed by the library any more
+ * the payload has length + 1 byte (text is 0 terminated)
+ * @param num uint8_t client id
+ * @return payload or NULL (no payload or already detached)
+ */
+uint8_t * WebSocketsServerBase::detachPayload(uint8_t num) {
+    if(num >= _clientMax) {
+        return NULL;
+    }
+    return WebSockets::detachPayload(&_clients[num]);
+}
+
+/**
+ * frees a payload taken with detachPayload
+ * @param payload uint8_t *
+ */
+void WebSocketsServerBase::releasePayload(uint8_t * payload) {
+    memFree(payload);
+}
+
 /*
  * set the Authorization for the http request
  * @param user const char *
  * @param password const char *
  */
-void WebSocketsServerCore::setAuthorization(const char * user, const char * password) {
+void WebSocketsServerBase::setAuthorization(const char * user, const char * password) {
+    if(!_allowAuthorization) {
+        DEBUG_WEBSOCKETS("[WS-Server] authorization is disabled by the server policy\n");
+        return;
+    }
     if(user && password) {
         String auth = user;
         auth += ":";
@@ -375,7 +536,11 @@ void WebSocketsServerCore::setAuthorization(const char * user, const char * pass
  * set the Authorizatio for the http request
  * @param auth const char * base64
  */
-void WebSocketsServerCore::setAuthorization(const char * auth) {
+void WebSocketsServerBase::setAuthorization(const char * auth) {
+    if(!_allowAuthorization) {
+        DEBUG_WEBSOCKETS("[WS-Server] authorization is disabled by the server policy\n");
+        return;
+    }
     if(auth) {
         _base64Authorization = auth;
     }
@@ -385,10 +550,10 @@ void WebSocketsServerCore::setAuthorization(const char * auth) {
  * count the connected clients (optional ping them)
  * @param ping bool ping the connected clients
  */
-int WebSocketsServerCore::connectedClients(bool ping) {
+int WebSocketsServerBase::connectedClients(bool ping) {
     WSclient_t * client;
     int count = 0;
-    for(uint8_t i = 0; i < WEBSOCKETS_SERVER_CLIENT_MAX; i++) {
+    for(uint8_t i = 0; i < _clientMax; i++) {
         client = &_clients[i];
         if(client->status == WSC_CONNECTED) {
             if(ping != true || sendPing(i)) {
@@ -403,8 +568,8 @@ int WebSocketsServerCore::connectedClients(bool ping) {
  * see if one client is connected
  * @param num uint8_t client id
  */
-bool WebSocketsServerCore::clientIsConnected(uint8_t num) {
-    if(num >= WEBSOCKETS_SERVER_CLIENT_MAX) {
+bool WebSocketsServerBase::clientIsConnected(uint8_t num) {
+    if(num >= _clientMax) {
         return false;
     }
     WSclient_t * client = &_clients[num];
@@ -417,8 +582,8 @@ bool WebSocketsServerCore::clientIsConnected(uint8_t num) {
  * @param num uint8_t client id
  * @return IPAddress
  */
-IPAddress WebSocketsServerCore::remoteIP(uint8_t num) {
-    if(num < WEBSOCKETS_SERVER_CLIENT_MAX) {
+IPAddress WebSocketsServerBase::remoteIP(uint8_t num) {
+    if(num < _clientMax) {
         WSclient_t * client = &_clients[num];
         if(clientIsConnected(client)) {
             return client->tcp->remoteIP();
@@ -437,10 +602,19 @@ IPAddress WebSocketsServerCore::remoteIP(uint8_t num) {
  * handle new client connection
  * @param client
  */
-WSclient_t * WebSocketsServerCore::newClient(WEBSOCKETS_NETWORK_CLASS * TCPclient) {
+WSclient_t * WebSocketsServerBase::newClient(WEBSOCKETS_NETWORK_CLASS * TCPclient) {
     WSclient_t * client;
+
+    if(_draining) {
+        DEBUG_WEBSOCKETS("[WS-Server] draining, new client refused\n");
+#if(WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP8266_ASYNC)
+        handleDrain();
+#endif
+        return nullptr;
+    }
+
     // search free list entry for client
-    for(uint8_t i = 0; i < WEBSOCKETS_SERVER_CLIENT_MAX; i++) {
+    for(uint8_t i = 0; i < _clientMax; i++) {
         client = &_clients[i];
 
         // look for match to existing socket before creating a new one
@@ -453,7 +627,20 @@ WSclient_t * WebSocketsServerCore::newClient(WEBSOCKETS_NETWORK_CLASS * TCPclien
 #endif
         } else {
             // state is not connected or tcp connection is lost
-            client->tcp = TCPclient;
+
+            // the handshake data is only allocated until the upgrade is done
+            memDelete(client->handshake);
+            client->handshake = memNew<WSclientHandshake_t>();
+            if(!client->handshake) {
+                DEBUG_WEBSOCKETS("[WS-Server][%d] no memory for the handshake\n", client->num);
+                return nullptr;
+            }
+
+            client->tcp               = TCPclient;
+            client->limits            = _limits;
+            client->cReassemble       = _reassemble;
+            client->cRxMessageLen     = 0;
+            client->handshake->cStart = millis();
 
 #if(WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP8266) || (WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP32)
             client->isSSL = false;
@@ -461,7 +648,7 @@ WSclient_t * WebSocketsServerCore::newClient(WEBSOCKETS_NETWORK_CLASS * TCPclien
 #endif
 #if(WEBSOCKETS_NETWORK_TYPE != NETWORK_ESP8266_ASYNC)
             // set Timeout for readBytesUntil and readStringUntil
-            client->tcp->setTimeout(WEBSOCKETS_TCP_TIMEOUT);
+            client->tcp->setTimeout(client->limits.readTimeout);
 #endif
             client->status = WSC_HEADER;
 #if(WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP8266) || (WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP8266_ASYNC) || (WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP32) || (WEBSOCKETS_NETWORK_TYPE == NETWORK_RP2040)
@@ -474,7 +661,7 @@ WSclient_t * WebSocketsServerCore::newClient(WEBSOCKETS_NETWORK_CLASS * TCPclien
 #endif
 
 #if(WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP8266_ASYNC)
-            client->tcp->onDisconnect(std::bind([](WebSocketsServerCore * server, AsyncTCPbuffer * obj, WSclient_t * client) -> bool {
+            client->tcp->onDisconnect(std::bind([](WebSocketsServerBase * server, AsyncTCPbuffer * obj, WSclient_t * client) -> bool {
                 DEBUG_WEBSOCKETS("[WS-Server][%d] Disconnect client\n", client->num);
 
                 AsyncTCPbuffer ** sl = &server->_clients[client->num].tcp;
@@ -482,11 +669,12 @@ WSclient_t * WebSocketsServerCore::newClient(WEBSOCKETS_NETWORK_CLASS * TCPclien
                     client->status = WSC_NOT_CONNECTED;
                     *sl            = NULL;
                 }
+                server->handleDrain();
                 return true;
             },
                 this, std::placeholders::_1, client));
 
-            client->tcp->readStringUntil('\n', &(client->cHttpLine), std::bind(&WebSocketsServerCore::handleHeader, this, client, &(client->cHttpLine)));
+            client->tcp->readStringUntil('\n', &(client->cHttpLine), std::bind(&WebSocketsServerBase::handleHeader, this, client, &(client->cHttpLine)));
 #endif
 
             client->pingInterval           = _pingInterval;
@@ -509,7 +697,7 @@ WSclient_t * WebSocketsServerCore::newClient(WEBSOCKETS_NETWORK_CLASS * TCPclien
  * @param payload  uint8_t *
  * @param length size_t
  */
-void WebSocketsServerCore::messageReceived(WSclient_t * client, WSopcode_t opcode, uint8_t * payload, size_t length, bool fin) {
+void WebSocketsServerBase::messageReceived(WSclient_t * client, WSopcode_t opcode, uint8_t * payload, size_t length, bool fin) {
     WStype_t type = WStype_ERROR;
 
     switch(opcode) {
@@ -534,13 +722,18 @@ void WebSocketsServerCore::messageReceived(WSclient_t * client, WSopcode_t opcod
     }
 
     runCbEvent(client->num, type, payload, length);
+
+#if(WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP8266_ASYNC)
+    // no loop() to check the drain timeout
+    handleDrain();
+#endif
 }
 
 /**
  * Discard a native client
  * @param client WSclient_t *  ptr to the client struct contaning the native client "->tcp"
  */
-void WebSocketsServerCore::dropNativeClient(WSclient_t * client) {
+void WebSocketsServerBase::dropNativeClient(WSclient_t * client) {
     if(!client) {
         return;
     }
@@ -556,7 +749,7 @@ void WebSocketsServerCore::dropNativeClient(WSclient_t * client) {
 #elif(WEBSOCKETS_NETWORK_TYPE == NETWORK_WIFI_NINA) || (WEBSOCKETS_NETWORK_TYPE == NETWORK_SAMD_SEED)
         // does not support delete (no destructor)
 #else
-        delete client->tcp;
+        memDelete(client->tcp);
 #endif
         client->tcp = NULL;
     }
@@ -566,7 +759,7 @@ void WebSocketsServerCore::dropNativeClient(WSclient_t * client) {
  * Disconnect an client
  * @param client WSclient_t *  ptr to the client struct
  */
-void WebSocketsServerCore::clientDisconnect(WSclient_t * client) {
+void WebSocketsServerBase::clientDisconnect(WSclient_t * client) {
 #if(WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP8266) || (WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP32) || (WEBSOCKETS_NETWORK_TYPE == NETWORK_RP2040)
     if(client->isSSL && client->ssl) {
         if(client->ssl->connected()) {
@@ -581,13 +774,11 @@ void WebSocketsServerCore::clientDisconnect(WSclient_t * client) {
 
     dropNativeClient(client);
 
-    client->cUrl         = "";
-    client->cKey         = "";
-    client->cProtocol    = "";
-    client->cVersion     = 0;
-    client->cIsUpgrade   = false;
-    client->cIsWebsocket = false;
+    memDelete(client->handshake);
+    client->handshake = NULL;
 
+    freeRxBuffer(client);
+    freeMessageBuffer(client);
     client->cWsRXsize = 0;
 
 #if(WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP8266_ASYNC)
@@ -606,7 +797,7 @@ void WebSocketsServerCore::clientDisconnect(WSclient_t * client) {
  * @param client WSclient_t *  ptr to the client struct
  * @return true = connected
  */
-bool WebSocketsServerCore::clientIsConnected(WSclient_t * client) {
+bool WebSocketsServerBase::clientIsConnected(WSclient_t * client) {
     if(!client->tcp) {
         return false;
     }
@@ -636,7 +827,7 @@ bool WebSocketsServerCore::clientIsConnected(WSclient_t * client) {
 /**
  * Handle incoming Connection Request
  */
-WSclient_t * WebSocketsServerCore::handleNewClient(WEBSOCKETS_NETWORK_CLASS * tcpClient) {
+WSclient_t * WebSocketsServerBase::handleNewClient(WEBSOCKETS_NETWORK_CLASS * tcpClient) {
     WSclient_t * client = newClient(tcpClient);
 
     if(!client) {
@@ -665,16 +856,26 @@ WSclient_t * WebSocketsServerCore::handleNewClient(WEBSOCKETS_NETWORK_CLASS * tc
 /**
  * Handle incoming Connection Request
  */
-void WebSocketsServer::handleNewClients(void) {
+void WebSocketsServerBase::handleNewClients(void) {
+    for(uint8_t i = 0; i < _listenerCount; i++) {
+        handleNewClients(_listeners[i]);
+    }
+}
+
+/**
+ * Handle incoming Connection Request of one listener
+ * @param server WEBSOCKETS_NETWORK_SERVER_CLASS *
+ */
+void WebSocketsServerBase::handleNewClients(WEBSOCKETS_NETWORK_SERVER_CLASS * server) {
 #if(WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP8266) || (WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP32) || (WEBSOCKETS_NETWORK_TYPE == NETWORK_RP2040)
-    while(_server->hasClient()) {
+    while(server->hasClient()) {
 #endif
 
 // store new connection
 #if(WEBSOCKETS_NETWORK_TYPE == NETWORK_WIFI_NINA)
-        WEBSOCKETS_NETWORK_CLASS * tcpClient = new WEBSOCKETS_NETWORK_CLASS(_server->available());
+        WEBSOCKETS_NETWORK_CLASS * tcpClient = memNew<WEBSOCKETS_NETWORK_CLASS>(server->available());
 #else
-    WEBSOCKETS_NETWORK_CLASS * tcpClient = new WEBSOCKETS_NETWORK_CLASS(_server->accept());
+    WEBSOCKETS_NETWORK_CLASS * tcpClient = memNew<WEBSOCKETS_NETWORK_CLASS>(server->accept());
 #endif
 
         if(!tcpClient) {
@@ -692,20 +893,30 @@ void WebSocketsServer::handleNewClients(void) {
 /**
  * Handel incomming data from Client
  */
-void WebSocketsServerCore::handleClientData(void) {
+void WebSocketsServerBase::handleClientData(void) {
     WSclient_t * client;
-    for(uint8_t i = 0; i < WEBSOCKETS_SERVER_CLIENT_MAX; i++) {
+    for(uint8_t i = 0; i < _clientMax; i++) {
         client = &_clients[i];
+        if(clientIsConnected(client) && client->status == WSC_HEADER && client->handshake && (millis() - client->handshake->cStart) > client->limits.handshakeTimeout) {
+            DEBUG_WEBSOCKETS("[WS-Server][%d][handleClientData] handshake timeout.. disconnecting!\n", client->num);
+            clientDisconnect(client);
+        }
         if(clientIsConnected(client)) {
-            int len = client->tcp->available();
-            if(len > 0) {
+            // handle everything already buffered for this client (bounded to keep the other clients served)
+            for(uint8_t n = 0; n < WEBSOCKETS_MAX_FRAMES_PER_LOOP; n++) {
+                int len = client->tcp->available();
+                if(len <= 0) {
+                    break;
+                }
                 // DEBUG_WEBSOCKETS("[WS-Server][%d][handleClientData] len: %d\n", client->num, len);
                 switch(client->status) {
                     case WSC_HEADER: {
-                        String headerLine = client->tcp->readStringUntil('\n');
-                        handleHeader(client, &headerLine);
+                        size_t lineLen    = 0;
+                        char * headerLine = handshakeReadLine(client, &lineLen);
+                        handleHeaderLine(client, headerLine, lineLen);
                     } break;
                     case WSC_CONNECTED:
+                    case WSC_CLOSING:
                         WebSockets::handleWebsocket(client);
                         break;
                     default:
@@ -713,6 +924,9 @@ void WebSocketsServerCore::handleClientData(void) {
                         WebSockets::clientDisconnect(client, 1002);
                         break;
                 }
+                if(!clientIsConnected(client)) {
+                    break;
+                }
             }
 
             handleHBPing(client);
@@ -727,7 +941,7 @@ void WebSocketsServerCore::handleClientData(void) {
  * returns an indicator whether the given named header exists in the configured _mandatoryHttpHeaders collection
  * @param headerName String ///< the name of the header being checked
  */
-bool WebSocketsServerCore::hasMandatoryHeader(String headerName) {
+bool WebSocketsServerBase::hasMandatoryHeader(String headerName) {
     for(size_t i = 0; i < _mandatoryHttpHeaderCount; i++) {
         if(_mandatoryHttpHeaders[i].equalsIgnoreCase(headerName))
             return true;
@@ -740,104 +954,136 @@ bool WebSocketsServerCore::hasMandatoryHeader(String headerName) {
  * @param client WSclient_t * ///< pointer to the client struct
  * @param headerLine String ///< the header being read / processed
  */
-void WebSocketsServerCore::handleHeader(WSclient_t * client, String * headerLine) {
-    static const char * NEW_LINE = "\r\n";
+void WebSocketsServerBase::handleHeader(WSclient_t * client, String * headerLine) {
+    size_t length = 0;
+    char * line   = handshakeLine(client, headerLine, &length);
+    handleHeaderLine(client, line, length);
 
-    headerLine->trim();    // remove \r
+#if(WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP8266_ASYNC)
+    handleDrain();
+#endif
+}
 
-    if(headerLine->length() > 0) {
-        DEBUG_WEBSOCKETS("[WS-Server][%d][handleHeader] RX: %s\n", client->num, headerLine->c_str());
+/**
+ * handles http header reading for WebSocket upgrade
+ * the line is parsed in place, everything kept is stored in the handshake arena
+ * @param client WSclient_t * ///< pointer to the client struct
+ * @param headerLine char * ///< the trimmed header line being processed
+ * @param length size_t ///< length of the header line
+ */
+void WebSocketsServerBase::handleHeaderLine(WSclient_t * client, char * headerLine, size_t length) {
+    if(!client->handshake) {
+        clientDisconnect(client);
+        return;
+    }
+
+    if(!headerLine) {
+        // longer than WEBSOCKETS_MAX_HEADER_LINE_SIZE or no memory for it
+        handleHeaderTooLarge(client);
+        return;
+    }
+
+    if(length > 0) {
+        DEBUG_WEBSOCKETS("[WS-Server][%d][handleHeader] RX: %s\n", client->num, headerLine);
+
+        char * headerValue = strchr(headerLine, ':');
 
         // websocket requests always start with GET see rfc6455
-        if(headerLine->startsWith("GET ")) {
+        if(strncmp(headerLine, "GET ", 4) == 0) {
             // cut URL out
-            client->cUrl = headerLine->substring(4, headerLine->indexOf(' ', 4));
+            char * url = headerLine + 4;
+            char * end = strchr(url, ' ');
+            if(end) {
+                *end = 0;
+            }
+            client->handshake->cUrl = url;
 
             // reset non-websocket http header validation state for this client
-            client->cHttpHeadersValid      = true;
-            client->cMandatoryHeadersCount = 0;
+            client->handshake->cHttpHeadersValid      = true;
+            client->handshake->cMandatoryHeadersCount = 0;
 
-        } else if(headerLine->indexOf(':') >= 0) {
-            String headerName  = headerLine->substring(0, headerLine->indexOf(':'));
-            String headerValue = headerLine->substring(headerLine->indexOf(':') + 1);
+        } else if(headerValue) {
+            *headerValue++ = 0;
+            char * headerName = headerLine;
 
             // remove space in the beginning (RFC2616)
-            if(headerValue[0] == ' ') {
-                headerValue.remove(0, 1);
+            while(*headerValue == ' ') {
+                headerValue++;
             }
 
-            if(headerName.equalsIgnoreCase(WEBSOCKETS_STRING("Connection"))) {
-                headerValue.toLowerCase();
-                if(headerValue.indexOf(WEBSOCKETS_STRING("upgrade")) >= 0) {
-                    client->cIsUpgrade = true;
+            if(WEBSOCKETS_STRCASEEQ(headerName, "Connection")) {
+                for(char * c = headerValue; *c; c++) {
+                    *c = tolower(*c);
                 }
-            } else if(headerName.equalsIgnoreCase(WEBSOCKETS_STRING("Upgrade"))) {
-                if(headerValue.equalsIgnoreCase(WEBSOCKETS_STRING("websocket"))) {
-                    client->cIsWebsocket = true;
+                if(strstr(headerValue, "upgrade")) {
+                    client->handshake->cIsUpgrade = true;
                 }
-            } else if(headerName.equalsIgnoreCase(WEBSOCKETS_STRING("Sec-WebSocket-Version"))) {
-                client->cVersion = headerValue.toInt();
-            } else if(headerName.equalsIgnoreCase(WEBSOCKETS_STRING("Sec-WebSocket-Key"))) {
-                client->cKey = headerValue;
-                client->cKey.trim();    // see rfc6455
-            } else if(headerName.equalsIgnoreCase(WEBSOCKETS_STRING("Sec-WebSocket-Protocol"))) {
-                client->cProtocol = headerValue;
-            } else if(headerName.equalsIgnoreCase(WEBSOCKETS_STRING("Sec-WebSocket-Extensions"))) {
-                client->cExtensions = headerValue;
-            } else if(headerName.equalsIgnoreCase(WEBSOCKETS_STRING("Authorization"))) {
-                client->base64Authorization = headerValue;
+            } else if(WEBSOCKETS_STRCASEEQ(headerName, "Upgrade")) {
+                if(WEBSOCKETS_STRCASEEQ(headerValue, "websocket")) {
+                    client->handshake->cIsWebsocket = true;
+                }
+            } else if(WEBSOCKETS_STRCASEEQ(headerName, "Sec-WebSocket-Version")) {
+                client->handshake->cVersion = atoi(headerValue);
+            } else if(WEBSOCKETS_STRCASEEQ(headerName, "Sec-WebSocket-Key")) {
+                // the line is already trimmed, see rfc6455
+                client->handshake->cKey = handshakeStore(client, headerValue, strlen(headerValue));
+            } else if(WEBSOCKETS_STRCASEEQ(headerName, "Sec-WebSocket-Protocol")) {
+                client->handshake->cProtocol = headerValue;
+            } else if(WEBSOCKETS_STRCASEEQ(headerName, "Sec-WebSocket-Extensions")) {
+                client->handshake->cExtensions = headerValue;
+            } else if(WEBSOCKETS_STRCASEEQ(headerName, "Authorization")) {
+                client->handshake->base64Authorization = headerValue;
             } else {
-                client->cHttpHeadersValid &= execHttpHeaderValidation(headerName, headerValue);
-                if(_mandatoryHttpHeaderCount > 0 && hasMandatoryHeader(headerName)) {
-                    client->cMandatoryHeadersCount++;
+                String name = headerName;
+                client->handshake->cHttpHeadersValid &= execHttpHeaderValidation(name, headerValue);
+                if(_mandatoryHttpHeaderCount > 0 && hasMandatoryHeader(name)) {
+                    client->handshake->cMandatoryHeadersCount++;
                 }
             }
 
         } else {
-            DEBUG_WEBSOCKETS("[WS-Client][handleHeader] Header error (%s)\n", headerLine->c_str());
+            DEBUG_WEBSOCKETS("[WS-Client][handleHeader] Header error (%s)\n", headerLine);
         }
 
-        (*headerLine) = "";
 #if(WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP8266_ASYNC)
-        client->tcp->readStringUntil('\n', &(client->cHttpLine), std::bind(&WebSocketsServerCore::handleHeader, this, client, &(client->cHttpLine)));
+        client->tcp->readStringUntil('\n', &(client->cHttpLine), std::bind(&WebSocketsServerBase::handleHeader, this, client, &(client->cHttpLine)));
 #endif
     } else {
         DEBUG_WEBSOCKETS("[WS-Server][%d][handleHeader] Header read fin.\n", client->num);
-        DEBUG_WEBSOCKETS("[WS-Server][%d][handleHeader]  - cURL: %s\n", client->num, client->cUrl.c_str());
-        DEBUG_WEBSOCKETS("[WS-Server][%d][handleHeader]  - cIsUpgrade: %d\n", client->num, client->cIsUpgrade);
-        DEBUG_WEBSOCKETS("[WS-Server][%d][handleHeader]  - cIsWebsocket: %d\n", client->num, client->cIsWebsocket);
-        DEBUG_WEBSOCKETS("[WS-Server][%d][handleHeader]  - cKey: %s\n", client->num, client->cKey.c_str());
-        DEBUG_WEBSOCKETS("[WS-Server][%d][handleHeader]  - cProtocol: %s\n", client->num, client->cProtocol.c_str());
-        DEBUG_WEBSOCKETS("[WS-Server][%d][handleHeader]  - cExtensions: %s\n", client->num, client->cExtensions.c_str());
-        DEBUG_WEBSOCKETS("[WS-Server][%d][handleHeader]  - cVersion: %d\n", client->num, client->cVersion);
-        DEBUG_WEBSOCKETS("[WS-Server][%d][handleHeader]  - base64Authorization: %s\n", client->num, client->base64Authorization.c_str());
-        DEBUG_WEBSOCKETS("[WS-Server][%d][handleHeader]  - cHttpHeadersValid: %d\n", client->num, client->cHttpHeadersValid);
-        DEBUG_WEBSOCKETS("[WS-Server][%d][handleHeader]  - cMandatoryHeadersCount: %d\n", client->num, client->cMandatoryHeadersCount);
-
-        bool ok = (client->cIsUpgrade && client->cIsWebsocket);
+        DEBUG_WEBSOCKETS("[WS-Server][%d][handleHeader]  - cURL: %s\n", client->num, client->handshake->cUrl.c_str());
+        DEBUG_WEBSOCKETS("[WS-Server][%d][handleHeader]  - cIsUpgrade: %d\n", client->num, client->handshake->cIsUpgrade);
+        DEBUG_WEBSOCKETS("[WS-Server][%d][handleHeader]  - cIsWebsocket: %d\n", client->num, client->handshake->cIsWebsocket);
+        DEBUG_WEBSOCKETS("[WS-Server][%d][handleHeader]  - cKey: %s\n", client->num, client->handshake->cKey ? client->handshake->cKey : "");
+        DEBUG_WEBSOCKETS("[WS-Server][%d][handleHeader]  - cProtocol: %s\n", client->num, client->handshake->cProtocol.c_str());
+        DEBUG_WEBSOCKETS("[WS-Server][%d][handleHeader]  - cExtensions: %s\n", client->num, client->handshake->cExtensions.c_str());
+        DEBUG_WEBSOCKETS("[WS-Server][%d][handleHeader]  - cVersion: %d\n", client->num, client->handshake->cVersion);
+        DEBUG_WEBSOCKETS("[WS-Server][%d][handleHeader]  - base64Authorization: %s\n", client->num, client->handshake->base64Authorization.c_str());
+        DEBUG_WEBSOCKETS("[WS-Server][%d][handleHeader]  - cHttpHeadersValid: %d\n", client->num, client->handshake->cHttpHeadersValid);
+        DEBUG_WEBSOCKETS("[WS-Server][%d][handleHeader]  - cMandatoryHeadersCount: %d\n", client->num, client->handshake->cMandatoryHeadersCount);
+
+        bool ok = (client->handshake->cIsUpgrade && client->handshake->cIsWebsocket);
 
         if(ok) {
-            if(client->cUrl.length() == 0) {
+            if(client->handshake->cUrl.length() == 0) {
                 ok = false;
             }
-            if(client->cKey.length() == 0) {
+            if(!client->handshake->cKey || client->handshake->cKey[0] == 0) {
                 ok = false;
             }
-            if(client->cVersion != 13) {
+            if(client->handshake->cVersion != 13) {
                 ok = false;
             }
-            if(!client->cHttpHeadersValid) {
+            if(!client->handshake->cHttpHeadersValid) {
                 ok = false;
             }
-            if(client->cMandatoryHeadersCount != _mandatoryHttpHeaderCount) {
+            if(client->handshake->cMandatoryHeadersCount != _mandatoryHttpHeaderCount) {
                 ok = false;
             }
         }
 
         if(_base64Authorization.length() > 0) {
-            String auth = WEBSOCKETS_STRING("Basic ");
-            auth += _base64Authorization;
-            if(auth != client->base64Authorization) {
+            const char * auth = client->handshake->base64Authorization.c_str();
+            if(strncmp(auth, "Basic ", 6) != 0 || _base64Authorization != (auth + 6)) {
                 DEBUG_WEBSOCKETS("[WS-Server][%d][handleHeader] HTTP Authorization failed!\n", client->num);
                 handleAuthorizationFailed(client);
                 return;
@@ -848,44 +1094,40 @@ void WebSocketsServerCore::handleHeader(WSclient_t * client, String * headerLine
             DEBUG_WEBSOCKETS("[WS-Server][%d][handleHeader] Websocket connection incoming.\n", client->num);
 
             // generate Sec-WebSocket-Accept key
-            String sKey = acceptKey(client->cKey);
+            char * sKey = acceptKey(client, client->handshake->cKey);
+            if(!sKey) {
+                clientDisconnect(client);
+                return;
+            }
 
-            DEBUG_WEBSOCKETS("[WS-Server][%d][handleHeader]  - sKey: %s\n", client->num, sKey.c_str());
+            DEBUG_WEBSOCKETS("[WS-Server][%d][handleHeader]  - sKey: %s\n", client->num, sKey);
 
             client->status = WSC_CONNECTED;
 
-            String handshake = WEBSOCKETS_STRING(
-                "HTTP/1.1 101 Switching Protocols\r\n"
-                "Server: arduino-WebSocketsServer\r\n"
-                "Upgrade: websocket\r\n"
-                "Connection: Upgrade\r\n"
-                "Sec-WebSocket-Version: 13\r\n"
-                "Sec-WebSocket-Accept: ");
-            handshake += sKey + NEW_LINE;
-
-            if(_origin.length() > 0) {
-                handshake += WEBSOCKETS_STRING("Access-Control-Allow-Origin: ");
-                handshake += _origin + NEW_LINE;
-            }
-
-            if(client->cProtocol.length() > 0) {
-                handshake += WEBSOCKETS_STRING("Sec-WebSocket-Protocol: ");
-                handshake += _protocol + NEW_LINE;
+            size_t len      = buildResponse(client, sKey, NULL);
+            char * response = handshakeAlloc(client, len + 1, true);
+            if(!response) {
+                clientDisconnect(client);
+                return;
             }
+            buildResponse(client, sKey, response);
+            response[len] = 0;
 
-            // header end
-            handshake += NEW_LINE;
-
-            DEBUG_WEBSOCKETS("[WS-Server][%d][handleHeader] handshake %s", client->num, (uint8_t *)handshake.c_str());
+            DEBUG_WEBSOCKETS("[WS-Server][%d][handleHeader] handshake %s", client->num, response);
 
-            write(client, (uint8_t *)handshake.c_str(), handshake.length());
+            write(client, (uint8_t *)response, len);
+            handshakeRelease(client, response);
 
             headerDone(client);
 
             // send ping
             WebSockets::sendFrame(client, WSop_ping);
 
-            runCbEvent(client->num, WStype_CONNECTED, (uint8_t *)client->cUrl.c_str(), client->cUrl.length());
+            runCbEvent(client->num, WStype_CONNECTED, (uint8_t *)client->handshake->cUrl.c_str(), client->handshake->cUrl.length());
+
+            // free the handshake data, only the hot part of WSclient_t stays for the connection
+            memDelete(client->handshake);
+            client->handshake = NULL;
 
         } else {
             handleNonWebsocketConnection(client);
@@ -893,10 +1135,45 @@ void WebSocketsServerCore::handleHeader(WSclient_t * client, String * headerLine
     }
 }
 
+/**
+ * build the http response for the WebSocket upgrade
+ * @param client WSclient_t *
+ * @param sKey const char *  Sec-WebSocket-Accept
+ * @param out char *   NULL to only get the length
+ * @return length of the response
+ */
+size_t WebSocketsServerBase::buildResponse(WSclient_t * client, const char * sKey, char * out) {
+    static const char * NEW_LINE = "\r\n";
+
+    size_t len = handshakeAppend(out, 0, WEBSOCKETS_STRING("HTTP/1.1 101 Switching Protocols\r\n"
+                                                           "Server: arduino-WebSocketsServer\r\n"
+                                                           "Upgrade: websocket\r\n"
+                                                           "Connection: Upgrade\r\n"
+                                                           "Sec-WebSocket-Version: 13\r\n"
+                                                           "Sec-WebSocket-Accept: "));
+    len        = handshakeAppend(out, len, sKey);
+    len        = handshakeAppend(out, len, NEW_LINE);
+
+    if(_origin.length() > 0) {
+        len = handshakeAppend(out, len, WEBSOCKETS_STRING("Access-Control-Allow-Origin: "));
+        len = handshakeAppend(out, len, _origin);
+        len = handshakeAppend(out, len, NEW_LINE);
+    }
+
+    if(client->handshake->cProtocol.length() > 0) {
+        len = handshakeAppend(out, len, WEBSOCKETS_STRING("Sec-WebSocket-Protocol: "));
+        len = handshakeAppend(out, len, _protocol);
+        len = handshakeAppend(out, len, NEW_LINE);
+    }
+
+    // header end
+    return handshakeAppend(out, len, NEW_LINE);
+}
+
 /**
  * send heartbeat ping to server in set intervals
  */
-void WebSocketsServerCore::handleHBPing(WSclient_t * client) {
+void WebSocketsServerBase::handleHBPing(WSclient_t * client) {
     if(client->pingInterval == 0)
         return;
     uint32_t pi = millis() - client->lastPing;
@@ -915,13 +1192,18 @@ void WebSocketsServerCore::handleHBPing(WSclient_t * client) {
  * @param pongTimeout uint32_t millis after which pong should timout if not received
  * @param disconnectTimeoutCount uint8_t how many timeouts before disconnect, 0=> do not disconnect
  */
-void WebSocketsServerCore::enableHeartbeat(uint32_t pingInterval, uint32_t pongTimeout, uint8_t disconnectTimeoutCount) {
+void WebSocketsServerBase::enableHeartbeat(uint32_t pingInterval, uint32_t pongTimeout, uint8_t disconnectTimeoutCount) {
+    if(!_allowHeartbeat) {
+        DEBUG_WEBSOCKETS("[WS-Server] heartbeat is disabled by the server policy\n");
+        return;
+    }
+
     _pingInterval           = pingInterval;
     _pongTimeout            = pongTimeout;
     _disconnectTimeoutCount = disconnectTimeoutCount;
 
     WSclient_t * client;
-    for(uint8_t i = 0; i < WEBSOCKETS_SERVER_CLIENT_MAX; i++) {
+    for(uint8_t i = 0; i < _clientMax; i++) {
         client = &_clients[i];
         WebSockets::enableHeartbeat(client, pingInterval, pongTimeout, disconnectTimeoutCount);
     }
@@ -930,37 +1212,157 @@ void WebSocketsServerCore::enableHeartbeat(uint32_t pingInterval, uint32_t pongT
 /**
  * disable ping/pong heartbeat process
  */
-void WebSocketsServerCore::disableHeartbeat() {
+void WebSocketsServerBase::disableHeartbeat() {
     _pingInterval = 0;
 
     WSclient_t * client;
-    for(uint8_t i = 0; i < WEBSOCKETS_SERVER_CLIENT_MAX; i++) {
+    for(uint8_t i = 0; i < _clientMax; i++) {
         client               = &_clients[i];
         client->pingInterval = 0;
     }
 }
 
-////////////////////
-// WebSocketServer
+/**
+ * set the limits for new connections
+ * running connections keep their limits
+ * @param limits const WSlimits_t &
+ */
+void WebSocketsServerBase::setLimits(const WSlimits_t & limits) {
+    _limits = limits;
+}
 
 /**
- * called to initialize the Websocket server
+ * limits for new connections
+ * @return WSlimits_t
  */
-void WebSocketsServer::begin(void) {
-    WebSocketsServerCore::begin();
-    _server->begin();
+WSlimits_t WebSocketsServerBase::getLimits(void) {
+    return _limits;
+}
 
-    DEBUG_WEBSOCKETS("[WS-Server] Server Started.\n");
+/**
+ * set the limits of one connection (e.g. in the WStype_CONNECTED event)
+ * @param num uint8_t client id
+ * @param limits const WSlimits_t &
+ * @return true if ok
+ */
+bool WebSocketsServerBase::setLimits(uint8_t num, const WSlimits_t & limits) {
+    if(num >= _clientMax) {
+        return false;
+    }
+    WSclient_t * client = &_clients[num];
+    if(!clientIsConnected(client)) {
+        return false;
+    }
+    client->limits = limits;
+    return true;
 }
 
-void WebSocketsServer::close(void) {
-    WebSocketsServerCore::close();
+/**
+ * deliver fragmented messages in one piece (WStype_TEXT / WStype_BIN) instead of WStype_FRAGMENT_* events
+ * the message size is bounded by the maxMessageSize limit (maxFrameSize if not set)
+ * used for new connections
+ * @param enable bool
+ */
+void WebSocketsServerBase::setReassembly(bool enable) {
+    _reassemble = enable;
+}
+
+/**
+ * writer to build a text message for a client in place (no copy, see WebSocketsFrameWriter)
+ * @param num uint8_t client id
+ * @return WebSocketsFrameWriter, send it with send()
+ */
+WebSocketsFrameWriter WebSocketsServerBase::frameTXT(uint8_t num) {
+    return WebSocketsFrameWriter(sendFrameWriter, this, num, WSop_text);
+}
+
+/**
+ * writer to build a binary message for a client in place (no copy, see WebSocketsFrameWriter)
+ * @param num uint8_t client id
+ * @return WebSocketsFrameWriter, send it with send()
+ */
+WebSocketsFrameWriter WebSocketsServerBase::frameBIN(uint8_t num) {
+    return WebSocketsFrameWriter(sendFrameWriter, this, num, WSop_binary);
+}
+
+/**
+ * send function of the frame writers
+ * @param server void *  WebSocketsServerBase
+ * @param payload uint8_t *  with WEBSOCKETS_MAX_HEADER_SIZE header room
+ * @param length size_t  payload length (0 = empty message)
+ */
+bool WebSocketsServerBase::sendFrameWriter(void * server, uint8_t num, WSopcode_t opcode, uint8_t * payload, size_t length) {
+    WebSocketsServerBase * s = (WebSocketsServerBase *)server;
+    if(num >= s->_clientMax) {
+        return false;
+    }
+    WSclient_t * client = &s->_clients[num];
+    if(s->clientIsConnected(client)) {
+        return s->sendFrame(client, opcode, payload, length, true, true);
+    }
+    return false;
+}
+
+/**
+ * limits of one connection
+ * @param num uint8_t client id
+ * @return WSlimits_t (the server limits if num is not connected)
+ */
+WSlimits_t WebSocketsServerBase::getLimits(uint8_t num) {
+    if(num < _clientMax && clientIsConnected(&_clients[num])) {
+        return _clients[num].limits;
+    }
+    return _limits;
+}
+
+/**
+ * listen on a additional port, new connections end up in the same client list
+ * can be called before or after begin()
+ * @param port uint16_t
+ * @return true if ok
+ */
+bool WebSocketsServerBase::addListener(uint16_t port) {
+    if(_listenerCount >= WEBSOCKETS_SERVER_LISTENER_MAX) {
+        DEBUG_WEBSOCKETS("[WS-Server] no free listener slot for port %u\n", port);
+        return false;
+    }
+
+    WEBSOCKETS_NETWORK_SERVER_CLASS * server = memNew<WEBSOCKETS_NETWORK_SERVER_CLASS>(port);
+    if(!server) {
+        return false;
+    }
+    initListener(server);
+
+    _listeners[_listenerCount] = server;
+    _listenerCount++;
+
+    if(_runnning) {
+        server->begin();
+    }
+
+    DEBUG_WEBSOCKETS("[WS-Server] added listener on port %u\n", port);
+    return true;
+}
+
+void WebSocketsServerBase::initListener(WEBSOCKETS_NETWORK_SERVER_CLASS * server) {
+#if(WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP8266_ASYNC)
+    server->onClient([](void * s, AsyncClient * c) {
+        ((WebSocketsServerBase *)s)->newClient(new AsyncTCPbuffer(c));
+    },
+        this);
+#else
+    UNUSED(server);
+#endif
+}
+
+void WebSocketsServerBase::closeListener(WEBSOCKETS_NETWORK_SERVER_CLASS * server) {
 #if(WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP8266) || (WEBSOCKETS_NETWORK_TYPE == NETWORK_RP2040)
-    _server->close();
+    server->close();
 #elif(WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP32) || (WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP8266_ASYNC)
-    _server->end();
+    server->end();
 #else
     // TODO how to close server?
+    UNUSED(server);
 #endif
 }
 
@@ -968,21 +1370,63 @@ void WebSocketsServer::close(void) {
 /**
  * called in arduino loop
  */
-void WebSocketsServerCore::loop(void) {
+void WebSocketsServerBase::loop(void) {
     if(_runnning) {
         WEBSOCKETS_YIELD();
+        handleNewClients();
         handleClientData();
+        handleDrain();
     }
 }
 
 /**
- * called in arduino loop
+ * time until loop() has work to do, can be used to sleep between loop() calls
+ * incoming data needs to wake the application up too
+ * @return ms, 0 = call loop() now, WEBSOCKETS_NO_TIMEOUT = no timer running
  */
-void WebSocketsServer::loop(void) {
-    if(_runnning) {
-        WEBSOCKETS_YIELD();
-        handleNewClients();
-        WebSocketsServerCore::loop();
+uint32_t WebSocketsServerBase::nextTimeout(void) {
+    if(!_runnning) {
+        return WEBSOCKETS_NO_TIMEOUT;
+    }
+
+#if(WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP8266) || (WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP32) || (WEBSOCKETS_NETWORK_TYPE == NETWORK_RP2040)
+    if(!_draining) {
+        for(uint8_t i = 0; i < _listenerCount; i++) {
+            if(_listeners[i]->hasClient()) {
+                return 0;
+            }
+        }
+    }
+#endif
+
+    uint32_t timeout = WEBSOCKETS_NO_TIMEOUT;
+
+    if(_draining) {
+        uint32_t d = millis() - _drainStart;
+        timeout    = (d >= _drainTimeout) ? 0 : (_drainTimeout - d);
+    }
+
+    WSclient_t * client;
+    for(uint8_t i = 0; i < _clientMax; i++) {
+        client = &_clients[i];
+        // only look at the state, clientIsConnected() would clean up and fire events
+        if(!client->tcp) {
+            continue;
+        }
+        if(!client->tcp->connected() || client->status == WSC_NOT_CONNECTED) {
+            // connection lost, loop() does the cleanup
+            return 0;
+        }
+        if(client->tcp->available() > 0) {
+            return 0;
+        }
+        if(client->status == WSC_HEADER && client->handshake) {
+            // handshake deadline
+            uint32_t d = millis() - client->handshake->cStart;
+            timeout    = std::min(timeout, (d > client->limits.handshakeTimeout) ? 0 : (client->limits.handshakeTimeout - d + 1));
+        }
+        timeout = std::min(timeout, nextHBTimeout(client));
     }
+    return timeout;
 }
 #endif
@@ -26,28 +26,74 @@
 #define WEBSOCKETSSERVER_H_
 
 #include "WebSockets.h"
+#include "WebSocketsFrameWriter.h"
 
 #ifndef WEBSOCKETS_SERVER_CLIENT_MAX
 #define WEBSOCKETS_SERVER_CLIENT_MAX (5)
 #endif
 
-class WebSocketsServerCore : protected WebSockets {
+#ifndef WEBSOCKETS_SERVER_LISTENER_MAX
+// max listening sockets (ports) of one WebSocketsServer
+#define WEBSOCKETS_SERVER_LISTENER_MAX (4)
+#endif
+
+static_assert(WEBSOCKETS_SERVER_LISTENER_MAX >= 1, "a server needs at least one listener (the constructor port)");
+
+/**
+ * compile time settings of a server, the defaults come from the config macros
+ * derive from it and override what differs:
+ *   struct SmallServer : WebSocketsServerPolicy { static const uint8_t clientMax = 2; };
+ *   BasicWebSocketsServer<SmallServer> small(81);
+ *
+ * maxDataSize and tcpTimeout are the defaults of the server limits (setLimits() can still change them).
+ * heartbeat = false / authorization = false: enableHeartbeat() / setAuthorization() do not compile when
+ * called on the server type and are ignored when called through WebSocketsServerBase.
+ * the server code itself is shared by all servers in the .cpp, so it is not compiled out.
+ */
+struct WebSocketsServerPolicy {
+    static const uint8_t clientMax   = WEBSOCKETS_SERVER_CLIENT_MAX;    ///< client slots of the server
+    static const size_t maxDataSize  = WEBSOCKETS_MAX_DATA_SIZE;        ///< default max payload of one frame (WSlimits_t::maxFrameSize)
+    static const uint32_t tcpTimeout = WEBSOCKETS_TCP_TIMEOUT;          ///< default read / write / handshake timeout in ms
+    static const bool heartbeat      = true;                            ///< enableHeartbeat() is available
+    static const bool authorization  = true;                            ///< setAuthorization() is available
+};
+
+/**
+ * server implementation, works on the client slots given by the derived class
+ * use WebSocketsServerCore / WebSocketsServer / BasicWebSocketsServer
+ */
+class WebSocketsServerBase : protected WebSockets {
+  protected:
+    WebSocketsServerBase(WSclient_t * clients, uint8_t clientMax, const String & origin = "", const String & protocol = "arduino");
+    WebSocketsServerBase(WSclient_t * clients, uint8_t clientMax, uint16_t port, const String & origin = "", const String & protocol = "arduino");
+
   public:
-    WebSocketsServerCore(const String & origin = "", const String & protocol = "arduino");
-    virtual ~WebSocketsServerCore(void);
+    virtual ~WebSocketsServerBase(void);
 
     void begin(void);
     void close(void);
 
+    bool addListener(uint16_t port);
+
+    void drain(uint32_t timeout = 5000);
+    bool isDraining(void);
+    int drainPending(void);
+
 #ifdef __AVR__
     typedef void (*WebSocketServerEvent)(uint8_t num, WStype_t type, uint8_t * payload, size_t length);
+    typedef uint8_t * (*WebSocketServerBufferProvider)(uint8_t num, size_t size);
     typedef bool (*WebSocketServerHttpHeaderValFunc)(String headerName, String headerValue);
 #else
     typedef std::function<void(uint8_t num, WStype_t type, uint8_t * payload, size_t length)> WebSocketServerEvent;
+    typedef std::function<uint8_t *(uint8_t num, size_t size)> WebSocketServerBufferProvider;
     typedef std::function<bool(String headerName, String headerValue)> WebSocketServerHttpHeaderValFunc;
 #endif
+    // plain function with a user pointer, called directly (no std::function)
+    typedef void (*WebSocketServerEventArg)(void * arg, uint8_t num, WStype_t type, uint8_t * payload, size_t length);
 
     void onEvent(WebSocketServerEvent cbEvent);
+    void onEvent(WebSocketServerEventArg cbEvent, void * arg);
+    void onBuffer(WebSocketServerBufferProvider cbBuffer);
     void onValidateHttpHeader(
         WebSocketServerHttpHeaderValFunc validationFunc,
         const char * mandatoryHttpHeaders[],
@@ -68,6 +114,8 @@ class WebSocketsServerCore : protected WebSockets {
     bool sendBIN(uint8_t num, uint8_t * payload, size_t length, bool headerToPayload = false);
     bool sendBIN(uint8_t num, const uint8_t * payload, size_t length);
 
+    bool sendStream(uint8_t num, Stream & stream, size_t length = WEBSOCKETS_STREAM_UNTIL_END, bool text = false);
+
     bool broadcastBIN(uint8_t * payload, size_t length, bool headerToPayload = false);
     bool broadcastBIN(const uint8_t * payload, size_t length);
 
@@ -80,6 +128,9 @@ class WebSocketsServerCore : protected WebSockets {
     void disconnect(void);
     void disconnect(uint8_t num);
 
+    uint8_t * detachPayload(uint8_t num);
+    static void releasePayload(uint8_t * payload);
+
     void setAuthorization(const char * user, const char * password);
     void setAuthorization(const char * auth);
 
@@ -90,12 +141,23 @@ class WebSocketsServerCore : protected WebSockets {
     void enableHeartbeat(uint32_t pingInterval, uint32_t pongTimeout, uint8_t disconnectTimeoutCount);
     void disableHeartbeat();
 
+    void setLimits(const WSlimits_t & limits);
+    WSlimits_t getLimits(void);
+    bool setLimits(uint8_t num, const WSlimits_t & limits);
+    WSlimits_t getLimits(uint8_t num);
+
+    void setReassembly(bool enable);
+
+    WebSocketsFrameWriter frameTXT(uint8_t num);
+    WebSocketsFrameWriter frameBIN(uint8_t num);
+
 #if(WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP8266) || (WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP8266_ASYNC) || (WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP32) || (WEBSOCKETS_NETWORK_TYPE == NETWORK_RP2040)
     IPAddress remoteIP(uint8_t num);
 #endif
 
 #if(WEBSOCKETS_NETWORK_TYPE != NETWORK_ESP8266_ASYNC)
-    void loop(void);    // handle client data only
+    void loop(void);    // handle incoming client (if listening) and client data
+    uint32_t nextTimeout(void);
 #endif
 
     WSclient_t * newClient(WEBSOCKETS_NETWORK_CLASS * TCPclient);
@@ -107,17 +169,37 @@ class WebSocketsServerCore : protected WebSockets {
     String * _mandatoryHttpHeaders;
     size_t _mandatoryHttpHeaderCount;
 
-    WSclient_t _clients[WEBSOCKETS_SERVER_CLIENT_MAX];
+    WSclient_t * _clients;    ///< client slots (owned by BasicWebSocketsServer)
+    uint8_t _clientMax;       ///< number of client slots
 
     WebSocketServerEvent _cbEvent;
+    WebSocketServerEventArg _cbEventArg;
+    void * _cbEventArgPtr;
+    WebSocketServerBufferProvider _cbBuffer;
     WebSocketServerHttpHeaderValFunc _httpHeaderValidationFunc;
 
     bool _runnning;
 
+    bool _draining;
+    uint32_t _drainStart;
+    uint32_t _drainTimeout;
+
     uint32_t _pingInterval;
     uint32_t _pongTimeout;
     uint8_t _disconnectTimeoutCount;
 
+    WSlimits_t _limits;    ///< limits for new connections
+    bool _reassemble;      ///< reassemble fragmented messages of new connections
+
+    bool _allowHeartbeat;        ///< Policy::heartbeat
+    bool _allowAuthorization;    ///< Policy::authorization
+
+    uint16_t _port;    ///< port of the constructor, 0 = no own listener
+
+    ///< listening sockets, [0] is the one of the constructor port, all feeding the same client list
+    WEBSOCKETS_NETWORK_SERVER_CLASS * _listeners[WEBSOCKETS_SERVER_LISTENER_MAX];
+    uint8_t _listenerCount;
+
     void messageReceived(WSclient_t * client, WSopcode_t opcode, uint8_t * payload, size_t length, bool fin);
 
     void clientDisconnect(WSclient_t * client);
@@ -126,11 +208,16 @@ class WebSocketsServerCore : protected WebSockets {
 #if(WEBSOCKETS_NETWORK_TYPE != NETWORK_ESP8266_ASYNC)
     void handleClientData(void);
 #endif
+    void handleDrain(void);
 
     void handleHeader(WSclient_t * client, String * headerLine);
+    void handleHeaderLine(WSclient_t * client, char * headerLine, size_t length);
+    size_t buildResponse(WSclient_t * client, const char * sKey, char * out);
 
     void handleHBPing(WSclient_t * client);    // send ping in specified intervals
 
+    static bool sendFrameWriter(void * server, uint8_t num, WSopcode_t opcode, uint8_t * payload, size_t length);
+
     /**
      * called if a non Websocket connection is coming in.
      * Note: can be override
@@ -169,6 +256,35 @@ class WebSocketsServerCore : protected WebSockets {
         clientDisconnect(client);
     }
 
+    /**
+     * called if a header line of the request is too long (WEBSOCKETS_MAX_HEADER_LINE_SIZE)
+     * Note: can be override
+     * @param client WSclient_t *  ptr to the client struct
+     */
+    virtual void handleHeaderTooLarge(WSclient_t * client) {
+        DEBUG_WEBSOCKETS("[WS-Server][%d][handleHeader] header line too long.\n", client->num);
+        client->tcp->write(
+            "HTTP/1.1 431 Request Header Fields Too Large\r\n"
+            "Server: arduino-WebSocket-Server\r\n"
+            "Content-Length: 0\r\n"
+            "Connection: close\r\n"
+            "\r\n");
+        clientDisconnect(client);
+    }
+
+    /**
+     * asks the buffer provider of the app for the payload buffer
+     * @param client WSclient_t *
+     * @param size size_t
+     * @return buffer or NULL to use malloc
+     */
+    uint8_t * provideBuffer(WSclient_t * client, size_t size) {
+        if(_cbBuffer) {
+            return _cbBuffer(client->num, size);
+        }
+        return NULL;
+    }
+
     /**
      * called for sending a Event to the app
      * @param num uint8_t
@@ -177,7 +293,9 @@ class WebSocketsServerCore : protected WebSockets {
      * @param length size_t
      */
     virtual void runCbEvent(uint8_t num, WStype_t type, uint8_t * payload, size_t length) {
-        if(_cbEvent) {
+        if(_cbEventArg) {
+            _cbEventArg(_cbEventArgPtr, num, type, payload, length);
+        } else if(_cbEvent) {
             _cbEvent(num, type, payload, length);
         }
     }
@@ -201,8 +319,13 @@ class WebSocketsServerCore : protected WebSockets {
 
 #if(WEBSOCKETS_NETWORK_TYPE != NETWORK_ESP8266_ASYNC)
     WSclient_t * handleNewClient(WEBSOCKETS_NETWORK_CLASS * tcpClient);
+    void handleNewClients(void);
+    void handleNewClients(WEBSOCKETS_NETWORK_SERVER_CLASS * server);
 #endif
 
+    void initListener(WEBSOCKETS_NETWORK_SERVER_CLASS * server);
+    void closeListener(WEBSOCKETS_NETWORK_SERVER_CLASS * server);
+
     /**
      * drop native tcp connection (client->tcp)
      */
@@ -216,28 +339,103 @@ class WebSocketsServerCore : protected WebSockets {
     bool hasMandatoryHeader(String headerName);
 };
 
-class WebSocketsServer : public WebSocketsServerCore {
+/**
+ * client slots of BasicWebSocketsServer
+ * a base class so they exist before the server base is constructed
+ */
+template<uint8_t N>
+struct WebSocketsServerClients {
+    WSclient_t _clientSlots[N];
+};
+
+/**
+ * server with compile time settings, different servers in one binary can use different policies
+ * @tparam Policy WebSocketsServerPolicy or a struct derived from it
+ */
+template<typename Policy = WebSocketsServerPolicy>
+class BasicWebSocketsServer : private WebSocketsServerClients<Policy::clientMax>, public WebSocketsServerBase {
+    static_assert(Policy::clientMax > 0, "a server needs at least one client slot");
+    static_assert(Policy::maxDataSize > 0, "a server needs a max frame size");
+
   public:
-    WebSocketsServer(uint16_t port, const String & origin = "", const String & protocol = "arduino");
-    virtual ~WebSocketsServer(void);
+    /**
+     * server without own listening sockets, connections are handed in with newClient()
+     * @param origin const String &
+     * @param protocol const String &
+     */
+    explicit BasicWebSocketsServer(const String & origin = "", const String & protocol = "arduino")
+        : WebSocketsServerBase(this->_clientSlots, Policy::clientMax, origin, protocol) {
+        applyPolicy();
+    }
 
-    void begin(void);
-    void close(void);
+    /**
+     * server listening on port (more ports with addListener())
+     * @param port uint16_t
+     * @param origin const String &
+     * @param protocol const String &
+     */
+    explicit BasicWebSocketsServer(uint16_t port, const String & origin = "", const String & protocol = "arduino")
+        : WebSocketsServerBase(this->_clientSlots, Policy::clientMax, port, origin, protocol) {
+        applyPolicy();
+    }
 
-#if(WEBSOCKETS_NETWORK_TYPE != NETWORK_ESP8266_ASYNC)
-    void loop(void);    // handle incoming client and client data
-#else
-    // Async interface not need a loop call
-    void loop(void) __attribute__((deprecated)) {}
-#endif
+    void enableHeartbeat(uint32_t pingInterval, uint32_t pongTimeout, uint8_t disconnectTimeoutCount) {
+        static_assert(Policy::heartbeat, "heartbeat is disabled by the server policy");
+        WebSocketsServerBase::enableHeartbeat(pingInterval, pongTimeout, disconnectTimeoutCount);
+    }
+
+    void setAuthorization(const char * user, const char * password) {
+        static_assert(Policy::authorization, "authorization is disabled by the server policy");
+        WebSocketsServerBase::setAuthorization(user, password);
+    }
+
+    void setAuthorization(const char * auth) {
+        static_assert(Policy::authorization, "authorization is disabled by the server policy");
+        WebSocketsServerBase::setAuthorization(auth);
+    }
+
+  private:
+    void applyPolicy(void) {
+        _allowHeartbeat     = Policy::heartbeat;
+        _allowAuthorization = Policy::authorization;
+
+        WSlimits_t limits       = getLimits();
+        limits.maxFrameSize     = Policy::maxDataSize;
+        limits.readTimeout      = Policy::tcpTimeout;
+        limits.writeTimeout     = Policy::tcpTimeout;
+        limits.handshakeTimeout = Policy::tcpTimeout;
+        setLimits(limits);
+    }
+};
+
+/**
+ * server with the default policy, connections are handed in with newClient()
+ */
+class WebSocketsServerCore : public BasicWebSocketsServer<> {
+  public:
+    WebSocketsServerCore(const String & origin = "", const String & protocol = "arduino")
+        : BasicWebSocketsServer<>(origin, protocol) {
+    }
 
   protected:
-#if(WEBSOCKETS_NETWORK_TYPE != NETWORK_ESP8266_ASYNC)
-    void handleNewClients(void);
-#endif
+    WebSocketsServerCore(uint16_t port, const String & origin, const String & protocol)
+        : BasicWebSocketsServer<>(port, origin, protocol) {
+    }
+};
 
-    uint16_t _port;
-    WEBSOCKETS_NETWORK_SERVER_CLASS * _server;
+/**
+ * server with the default policy listening on a port
+ */
+class WebSocketsServer : public WebSocketsServerCore {
+  public:
+    WebSocketsServer(uint16_t port, const String & origin = "", const String & protocol = "arduino")
+        : WebSocketsServerCore(port, origin, protocol) {
+    }
+
+#if(WEBSOCKETS_NETWORK_TYPE == NETWORK_ESP8266_ASYNC)
+    // Async interface not need a loop call
+    void loop(void) __attribute__((deprecated)) {}
+#endif
 };
 
 #endif /* WEBSOCKETSSERVER_H_ */